@@ -3,21 +3,42 @@
    Date: Spring 2011
    Purpose: Parallel implementation of bucket sort
    */
+#ifdef MEMWATCH
 #include "memwatch.h"
+#endif
 #include<stdio.h>
 #include<stdlib.h>
-//#include<string.h>
+#include<string.h>
 #include<unistd.h>
 #include<mpi.h>
 #include<math.h>
 #include<time.h>
+#include<stdint.h>
+#include "radix_sort.h"
+#include "check.h"
 #define DEFAULT_ARRAY_SIZE 10
+#define NUM_TAG 10
+/* Keys each rank samples from an unsorted slice to choose the splitters */
+#define SAMPLES_PER_RANK 64
 #define MAX_NUM_SIZE 100
+/* Memory budget per rank in the out of core mode, in MB */
+#define DEFAULT_MEMORY 256
+
+/* Order preserving 64 bit prefix of the key at the start of a record */
+typedef uint64_t (*key_extract)(const unsigned char * record, int key_size);
 
 /* Struct to hold configuration options */
 typedef struct
 {
-    int rank,size, array_size,slice,max_num,verbose, print_array, print_ranges;
+    int rank,size, array_size,slice,max_num,verbose, print_array, print_ranges, skewed, verify;
+    /* Threads per rank */
+    int threads;
+    /* Out of core mode */
+    char * input, * output, * spill_dir;
+    long memory;
+    /* Record mode */
+    int record_size, key_size;
+    key_extract extract;
 } Params;
 
 /* Struct defining a bucket, that contains index items */
@@ -34,10 +55,46 @@ void bucket_insert(Bucket * b, int x)
     b->index = b->index +1;
 }
 
-/* Function to compare two values for sorting, needed for quick sort */
+/* Function to compare two values for sorting, needed for quick sort of the samples */
 int compare( const void * n1, const void * n2)
 {
-    return (*(int*)n1 - *(int*)n2);
+    /* Not a subtraction, keys read from a file may use the whole int range */
+    return (*(int*)n1 > *(int*)n2) - (*(int*)n1 < *(int*)n2);
+}
+
+/* Regular sampling (PSRS): every rank takes size evenly spaced samples of its sorted block,
+   the size-1 splitters are evenly spaced in the sorted samples of all ranks.
+   With distinct keys no rank receives more than twice its share, whatever the distribution. */
+int * choose_splitters(Params * p, int * sorted, int n)
+{
+    int i;
+    int * samples = (int *) malloc(sizeof(int)*p->size);
+    int * all = (int *) malloc(sizeof(int)*p->size*p->size);
+    int * splitters = (int *) malloc(sizeof(int)*p->size);
+    for(i = 0; i < p->size; i++)
+        samples[i] = sorted[(long) i * n / p->size];
+    MPI_Allgather(samples,p->size,MPI_INT,all,p->size,MPI_INT,MPI_COMM_WORLD);
+    qsort(all,p->size*p->size,sizeof(int),compare);
+    for(i = 1; i < p->size; i++)
+        splitters[i-1] = all[i*p->size + p->size/2 - 1];
+    free(samples);
+    free(all);
+    return splitters;
+}
+
+/* Bucket of x: the number of splitters that are <= x */
+int find_bucket(int * splitters, int num_splitters, int x)
+{
+    int low = 0, high = num_splitters, mid;
+    while(low < high)
+    {
+        mid = (low + high)/2;
+        if(splitters[mid] <= x)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
 }
 
 /* Checks a bucket for sortedness */
@@ -53,11 +110,90 @@ int check_bucket(Bucket * b)
     return 0;
 }
 
+/* Threaded partition and exchange of an unsorted block.
+   Each thread counts the destinations of its part of the block in its own histogram,
+   which gives every thread its own place in each destination's run of the send buffer,
+   so the scatter needs no shared counters.  The block is cut into p->threads slices
+   whatever team the runtime grants, so both passes see the same slices.
+   The receives are posted while the threads scatter, the sends as soon as the runs
+   are complete.  Returns the received keys. */
+int * exchange_threaded(Params * p, int * block, int n, int * splitters, int * received, Timer * timer)
+{
+    int i, d, sum, x, threads = p->threads, size = p->size;
+    int * dest = (int *) malloc(sizeof(int)*n);
+    int * offsets = (int *) malloc(sizeof(int)*threads*size);
+    int * send = (int *) malloc(sizeof(int)*n);
+    int * send_counts = (int *) calloc(size, sizeof(int));
+    int * send_disp = (int *) malloc(sizeof(int)*size);
+    int * recv_counts = (int *) malloc(sizeof(int)*size);
+    int * recv_disp = (int *) malloc(sizeof(int)*size);
+    MPI_Request * requests = (MPI_Request *) malloc(sizeof(MPI_Request)*2*size);
+#pragma omp parallel for schedule(static) num_threads(threads)
+    for(i = 0; i < threads; i++)
+    {
+        int k, * c = offsets + i*size;
+        long j, low = (long) n*i/threads, high = (long) n*(i+1)/threads;
+        for(k = 0; k < size; k++)
+            c[k] = 0;
+        for(j = low; j < high; j++)
+            c[dest[j] = find_bucket(splitters,size-1,block[j])]++;
+    }
+    /* Slice i's keys for d go after those of the lower slices for d */
+    for(d = 0, sum = 0; d < size; d++)
+    {
+        send_disp[d] = sum;
+        for(i = 0; i < threads; i++)
+        {
+            x = offsets[i*size + d];
+            offsets[i*size + d] = sum;
+            sum += x;
+            send_counts[d] += x;
+        }
+    }
+    MPI_Alltoall(send_counts,1,MPI_INT,recv_counts,1,MPI_INT,MPI_COMM_WORLD);
+    recv_disp[0] = 0;
+    for(i = 1; i < size; i++)
+        recv_disp[i] = recv_disp[i-1] + recv_counts[i-1];
+    *received = recv_disp[size-1] + recv_counts[size-1];
+    int * bucket = (int *) malloc(sizeof(int)*(*received));
+    for(i = 0; i < size; i++)
+        MPI_Irecv(bucket + recv_disp[i],recv_counts[i],MPI_INT,i,NUM_TAG,MPI_COMM_WORLD,&requests[i]);
+#pragma omp parallel for schedule(static) num_threads(threads)
+    for(i = 0; i < threads; i++)
+    {
+        int * c = offsets + i*size;
+        long j, low = (long) n*i/threads, high = (long) n*(i+1)/threads;
+        for(j = low; j < high; j++)
+            send[c[dest[j]]++] = block[j];
+    }
+    timer_phase(timer,"partition");
+    /* Start with the next rank so that not everybody sends to rank 0 first */
+    for(i = 0; i < size; i++)
+    {
+        d = (p->rank + 1 + i) % size;
+        MPI_Isend(send + send_disp[d],send_counts[d],MPI_INT,d,NUM_TAG,MPI_COMM_WORLD,&requests[size + i]);
+    }
+    MPI_Waitall(2*size,requests,MPI_STATUSES_IGNORE);
+    if(p->verbose)
+        for(i = 0; i < size; i++)
+            if(i != p->rank)
+                fprintf(stderr,"[%d] Received %d elements from %d\n",p->rank, recv_counts[i], i);
+    free(dest);
+    free(offsets);
+    free(send);
+    free(send_counts);
+    free(send_disp);
+    free(recv_counts);
+    free(recv_disp);
+    free(requests);
+    return bucket;
+}
+
 /* Function to be executed by the workers */
 void slave(Params * p)
 {  
     /* Timer */
-    double start, end;
+    double start = 0, end;
     
     /* Loop Counter */
     int i;
@@ -72,7 +208,13 @@ void slave(Params * p)
     int small_bucket_size = large_bucket_size;
     
     /* Pointer to the resulting array, only malloc'd by the master rank */
-    int * array;
+    int * array = NULL;
+
+    /* Phase timings and verification */
+    Timer timer;
+    Check check;
+    check_init(&check);
+    timer_start(&timer);
 
     /* To be executed by the master rank only, sets up the large array to be scattered */
     if(p->rank == 0)
@@ -89,6 +231,10 @@ void slave(Params * p)
         /* Initialize array with random numbers, from 0 to max_num */
         for(i = 0; i < p->array_size; i++)
             array[i] = rand()%(p->max_num);
+        /* Squaring crowds the numbers towards 0 */
+        if(p->skewed)
+            for(i = 0; i < p->array_size; i++)
+                array[i] = (int) (((long) array[i] * array[i]) / p->max_num);
         if(p->print_array)
             for(i = 0; i < p->array_size; i++)
                 fprintf(stderr,"Array[%d] = %d\n",i,array[i]);
@@ -103,72 +249,97 @@ void slave(Params * p)
                 Largest number:\t%d\n",num_buckets,large_bucket_size,small_bucket_size,p->array_size,p->max_num);
     }
 
-    /* Array of small buckets.
-       If the number of ranks is P, each rank has P smaller buckets. */
-    Bucket ** buckets = (Bucket **) malloc(sizeof(Bucket*)*num_buckets);
-    for(i = 0; i < num_buckets; i++)
-    {
-        /* Malloc pointer to the bucket */
-        buckets[i] = (Bucket *) malloc(sizeof(Bucket));
-        /* Malloc pointer to the bucket's array */
-        buckets[i]->array = (int*) malloc(sizeof(int)*small_bucket_size*2.0);
-        /* Index points to the next location to insert an element */
-        buckets[i]->index = 0;
-    }
-
     /* Large bucket to hold numbers from the initial scatter. */
     Bucket large_bucket;
-
-    /* NOTE: The overestimation of bucket sizes is due to rand() not producing a true uniform distribution. 
-       If the numbers are not uniformly distributed, some buckets will be larger than others. */
-    int * my_bucket_array = (int*) malloc(sizeof(int)*large_bucket_size*4.0);
-    large_bucket.array = my_bucket_array;
-    large_bucket.index = 0;
+    large_bucket.array = (int*) malloc(sizeof(int)*large_bucket_size);
+    large_bucket.index = large_bucket_size;
     
+    /* Scatter array into large buckets */
+    MPI_Scatter(array,large_bucket_size,MPI_INT,large_bucket.array,large_bucket_size,MPI_INT,0,MPI_COMM_WORLD);
+    timer_phase(&timer,"generate");
+    if(p->verify)
+        for(i = 0; i < large_bucket_size; i++)
+            check_in(&check,check_key_int(large_bucket.array[i]));
+
+    /* Choose the bucket boundaries from the data instead of assuming a uniform distribution.
+       The threaded path only sorts a regular sample of the block. */
+    int * splitters;
+    if(p->threads > 1)
+    {
+        int num_samples = (large_bucket_size < SAMPLES_PER_RANK*p->size) ? large_bucket_size : SAMPLES_PER_RANK*p->size;
+        int * samples = (int *) malloc(sizeof(int)*num_samples);
+        for(i = 0; i < num_samples; i++)
+            samples[i] = large_bucket.array[(long) i*large_bucket_size/num_samples];
+        radix_sort_int(samples,num_samples,1);
+        splitters = choose_splitters(p,samples,num_samples);
+        free(samples);
+    }
+    else
+    {
+        radix_sort_int(large_bucket.array,large_bucket_size,1);
+        splitters = choose_splitters(p,large_bucket.array,large_bucket_size);
+    }
+
     /* Print range of each bucket */
-    int range_min = (p->max_num*p->rank)/p->size, range_max = (p->max_num*(p->rank+1))/p->size;
+    int range_min = (p->rank == 0) ? 0 : splitters[p->rank-1];
+    int range_max = (p->rank == p->size-1) ? p->max_num : splitters[p->rank];
 
     if(p->print_ranges)
         fprintf(stderr,"Bucket [%d] %d => %d\n",p->rank,range_min,range_max);
-    
-    /* Scatter array into large buckets */
-    MPI_Scatter(array,large_bucket_size,MPI_INT,large_bucket.array,large_bucket_size,MPI_INT,0,MPI_COMM_WORLD);
-    int dest;
-    /* Place numbers from large bucket into small buckets */
-    for(i = 0; i < large_bucket_size; i++)
-    {
-        /* Calculate the destination bucket by mapping a number from 0 to max_num to
-           a bucket from 0 to num_buckets */
-        dest = (large_bucket.array[i] * num_buckets)/p->max_num;
-        /* If the destination is to my bucket, then insert it into my local bucket directly */
-        if(dest == p->rank)
-                bucket_insert(&large_bucket,large_bucket.array[i]);
-            /* Otherwise insert the number into someone else bucket */
-        else
-                bucket_insert(buckets[dest],large_bucket.array[i]);
+
+    /* Without threads the scattered block is sorted, so the small bucket for each rank is a
+       contiguous run of it and is sent in place: only its length and offset are needed */
+    int * send_counts = (int *) calloc(p->size, sizeof(int));
+    int * send_disp = (int *) malloc(sizeof(int) * p->size);
+    int * recv_counts = (int *) malloc(sizeof(int) * p->size);
+    int * recv_disp = (int *) malloc(sizeof(int) * p->size);
+    int current;
+    if(p->threads > 1)
+    {
+        int * my_bucket_array = exchange_threaded(p,large_bucket.array,large_bucket_size,splitters,&current,&timer);
+        free(large_bucket.array);
+        large_bucket.array = my_bucket_array;
     }
-    MPI_Request * requests = (MPI_Request *) malloc(sizeof(MPI_Request) * p->size);
-    /* Send each bucket to it's owner, non blocking so that there is no deadlock */
-    for(i = 0; i < p->size; i++)
-       /* Make sure I'm not sending to myself */
-       if(i != p->rank)
-           MPI_Isend(buckets[i]->array,small_bucket_size*2,MPI_INT,i,buckets[i]->index,MPI_COMM_WORLD,&requests[i]);
-    MPI_Status status;
-    /* Current is the location at which to begin inserting elements into my large bucket.  
-       My large bucket already contains my numbers, so begin there */
-    int current = large_bucket.index;
-    /* Receive small buckets from other ranks */
-    for(i = 0; i < p->size-1; i++)
-    {
-        MPI_Recv(&large_bucket.array[current],small_bucket_size*2,MPI_INT,MPI_ANY_SOURCE,MPI_ANY_TAG,MPI_COMM_WORLD,&status);
+    else
+    {
+        for(i = 0; i < large_bucket_size; i++)
+            send_counts[find_bucket(splitters,num_buckets-1,large_bucket.array[i])]++;
+
+        timer_phase(&timer,"partition");
+
+        /* Exchange the counts first, so the keys can be received into an exactly sized bucket */
+        MPI_Alltoall(send_counts,1,MPI_INT,recv_counts,1,MPI_INT,MPI_COMM_WORLD);
+        send_disp[0] = recv_disp[0] = 0;
+        for(i = 1; i < p->size; i++)
+        {
+            send_disp[i] = send_disp[i-1] + send_counts[i-1];
+            recv_disp[i] = recv_disp[i-1] + recv_counts[i-1];
+        }
+        current = recv_disp[p->size-1] + recv_counts[p->size-1];
         if(p->verbose)
-            fprintf(stderr,"[%d] Received %d elements from %d total now %d\n",p->rank, status.MPI_TAG, status.MPI_SOURCE,current+status.MPI_TAG);
-        current+=status.MPI_TAG;
+            for(i = 0; i < p->size; i++)
+                if(i != p->rank)
+                    fprintf(stderr,"[%d] Receiving %d elements from %d total now %d\n",p->rank, recv_counts[i], i, recv_disp[i]+recv_counts[i]);
+        int * my_bucket_array = (int*) malloc(sizeof(int)*current);
+        MPI_Alltoallv(large_bucket.array,send_counts,send_disp,MPI_INT,my_bucket_array,recv_counts,recv_disp,MPI_INT,MPI_COMM_WORLD);
+        free(large_bucket.array);
+        large_bucket.array = my_bucket_array;
     }
     large_bucket.index = current;
+    timer_phase(&timer,"exchange");
   
     /* Sort my bucket */
-    qsort(&large_bucket.array[0],current,sizeof(int),compare);
+    radix_sort_int(large_bucket.array,current,p->threads);
+    timer_phase(&timer,"sort");
+
+    /* The buckets are in rank order, so they can be checked where they are */
+    if(p->verify)
+    {
+        for(i = 0; i < current; i++)
+            check_out(&check,check_key_int(large_bucket.array[i]),check_key_int(large_bucket.array[i]));
+        check_finish(&check,MPI_COMM_WORLD);
+        timer_phase(&timer,"verify");
+    }
     
     /* Gather array sizes */
     int * sizes = (int *) malloc(sizeof(int)*p->size);
@@ -180,7 +351,7 @@ void slave(Params * p)
     if(p->rank == 0)
     {
         disp[0] = 0;
-        for(i = 1; i < p->size+1; ++i)
+        for(i = 1; i < p->size; ++i)
             disp[i] = disp[i-1] + sizes[i-1];
     }
 
@@ -194,6 +365,8 @@ void slave(Params * p)
     
     /* Gather results */
     MPI_Gatherv(large_bucket.array,current,MPI_INT,array,sizes,disp,MPI_INT,0,MPI_COMM_WORLD);
+    timer_phase(&timer,"gather");
+    timer_report(&timer,(double) p->array_size*sizeof(int),MPI_COMM_WORLD);
     
     /* Verbose Mode */
     if(p->rank == 0)
@@ -205,9 +378,616 @@ void slave(Params * p)
                 fprintf(stdout,"array[%d] = %d\n",i,array[i]);
         free(array);
     }
+    free(large_bucket.array);
+    free(splitters);
+    free(send_counts);
+    free(send_disp);
+    free(recv_counts);
+    free(recv_disp);
+    free(sizes);
+    free(disp);
     return;
 }
 
+/* Out of core mode: input and output are files of native ints.
+   Each rank reads its slice with MPI-IO in rounds of a fifth of the memory budget and
+   sends the keys to their buckets.  The keys a rank receives collect in a buffer of two
+   fifths, which is sorted and spilled to local disk as a run whenever it fills up; the
+   radix sort needs as much scratch again, so round, buffer and scratch fit the budget.
+   The runs are merged straight into the rank's part of the output file. */
+
+/* A sorted run in the spill file, with a buffer for merging */
+typedef struct
+{
+    long offset, length;    /* in keys */
+    long next;              /* next key to read from the file */
+    int * buffer;
+    long head, fill;
+} Run;
+
+/* All runs of one rank, written one after the other to the same file */
+typedef struct
+{
+    FILE * file;
+    char name[1024];
+    Run * runs;
+    int num_runs;
+    long length;
+} Spill;
+
+/* Sort the keys and append them to the spill file as a new run */
+void spill_run(Spill * s, int * keys, long n, int threads)
+{
+    radix_sort_int(keys,n,threads);
+    s->runs = (Run *) realloc(s->runs,sizeof(Run)*(s->num_runs+1));
+    s->runs[s->num_runs].offset = s->length;
+    s->runs[s->num_runs].length = n;
+    if(fseeko(s->file,s->length*sizeof(int),SEEK_SET) != 0 || fwrite(keys,sizeof(int),n,s->file) != (size_t) n)
+    {
+        fprintf(stderr,"Unable to write %s\n",s->name);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    s->length += n;
+    s->num_runs++;
+}
+
+/* Refill the buffer of a run, returns the number of keys now in it */
+long run_fill(Spill * s, Run * r, long capacity)
+{
+    long n = r->length - r->next;
+    if(n > capacity)
+        n = capacity;
+    if(n > 0 && (fseeko(s->file,(r->offset + r->next)*sizeof(int),SEEK_SET) != 0 || fread(r->buffer,sizeof(int),n,s->file) != (size_t) n))
+    {
+        fprintf(stderr,"Unable to read %s\n",s->name);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    r->next += n;
+    r->head = 0;
+    r->fill = n;
+    return n;
+}
+
+/* Sift down in a heap of run numbers ordered by the next key of each run */
+void heap_down(int * heap, int n, Run * runs, int i)
+{
+    int c, t;
+    while((c = 2*i + 1) < n)
+    {
+        if(c+1 < n && runs[heap[c+1]].buffer[runs[heap[c+1]].head] < runs[heap[c]].buffer[runs[heap[c]].head])
+            c++;
+        if(runs[heap[i]].buffer[runs[heap[i]].head] <= runs[heap[c]].buffer[runs[heap[c]].head])
+            break;
+        t = heap[i], heap[i] = heap[c], heap[c] = t;
+        i = c;
+    }
+}
+
+/* k-way merge of the runs, written to the output file from key number offset on.
+   The merged keys are passed to check_out() if check is not NULL. */
+void merge_runs(Spill * s, MPI_File out, long offset, long budget, Check * check)
+{
+    int k = s->num_runs, n = 0, i, r;
+    long capacity = budget/(k+1), fill = 0;
+    if(capacity < 1)
+        capacity = 1;
+    int * output = (int *) malloc(sizeof(int)*capacity);
+    int * heap = (int *) malloc(sizeof(int)*k);
+    for(i = 0; i < k; i++)
+    {
+        s->runs[i].buffer = (int *) malloc(sizeof(int)*capacity);
+        s->runs[i].next = 0;
+        if(run_fill(s,&s->runs[i],capacity) > 0)
+            heap[n++] = i;
+    }
+    for(i = n/2 - 1; i >= 0; i--)
+        heap_down(heap,n,s->runs,i);
+    while(n > 0)
+    {
+        r = heap[0];
+        output[fill] = s->runs[r].buffer[s->runs[r].head++];
+        if(check)
+            check_out(check,check_key_int(output[fill]),check_key_int(output[fill]));
+        fill++;
+        if(fill == capacity)
+        {
+            MPI_File_write_at(out,offset*sizeof(int),output,fill,MPI_INT,MPI_STATUS_IGNORE);
+            offset += fill;
+            fill = 0;
+        }
+        /* An exhausted run leaves the heap */
+        if(s->runs[r].head == s->runs[r].fill && run_fill(s,&s->runs[r],capacity) == 0)
+            heap[0] = heap[--n];
+        heap_down(heap,n,s->runs,0);
+    }
+    if(fill > 0)
+        MPI_File_write_at(out,offset*sizeof(int),output,fill,MPI_INT,MPI_STATUS_IGNORE);
+    for(i = 0; i < k; i++)
+        free(s->runs[i].buffer);
+    free(output);
+    free(heap);
+}
+
+void out_of_core(Params * p)
+{
+    MPI_File in, out;
+    MPI_Offset bytes;
+    Spill spill;
+    double start = MPI_Wtime();
+    long budget = p->memory/sizeof(int), chunk = budget/5, capacity = 2*budget/5;
+    long n, first, length, count, rounds, round, held = 0, total, offset = 0, incoming, room, pending;
+    int i, num_samples;
+    Timer timer;
+    Check check;
+    check_init(&check);
+    timer_start(&timer);
+    /* Only the ranks that fill up spill during the rounds, fix the order for the report */
+    timer_declare(&timer,"partition");
+    timer_declare(&timer,"read");
+    timer_declare(&timer,"exchange");
+    timer_declare(&timer,"sort");
+    if(chunk < 1)
+        chunk = capacity = 1;
+    if(MPI_File_open(MPI_COMM_WORLD,p->input,MPI_MODE_RDONLY,MPI_INFO_NULL,&in) != MPI_SUCCESS)
+    {
+        if(p->rank == 0) fprintf(stderr,"Unable to open %s\n",p->input);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    MPI_File_get_size(in,&bytes);
+    n = bytes/sizeof(int);
+    if(n < p->size)
+    {
+        if(p->rank == 0) fprintf(stderr,"Error: %s holds fewer keys than there are ranks.\n",p->input);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    first = n*p->rank/p->size;
+    length = n*(p->rank+1)/p->size - first;
+
+    /* Splitters from regular samples of the slice, read one key at a time */
+    num_samples = (length < SAMPLES_PER_RANK*p->size) ? length : SAMPLES_PER_RANK*p->size;
+    int * samples = (int *) malloc(sizeof(int)*num_samples);
+    for(i = 0; i < num_samples; i++)
+        MPI_File_read_at(in,(first + i*length/num_samples)*sizeof(int),&samples[i],1,MPI_INT,MPI_STATUS_IGNORE);
+    radix_sort_int(samples,num_samples,1);
+    int * splitters = choose_splitters(p,samples,num_samples);
+    free(samples);
+    timer_phase(&timer,"partition");
+
+    /* Every rank takes part in every round, even after its slice is used up */
+    rounds = (length + chunk - 1)/chunk;
+    MPI_Allreduce(MPI_IN_PLACE,&rounds,1,MPI_LONG,MPI_MAX,MPI_COMM_WORLD);
+    int * keys = (int *) malloc(sizeof(int)*chunk);
+    int * collected = (int *) malloc(sizeof(int)*capacity);
+    int * send_counts = (int *) malloc(sizeof(int) * p->size);
+    int * send_disp = (int *) malloc(sizeof(int) * p->size);
+    int * recv_counts = (int *) malloc(sizeof(int) * p->size);
+    int * recv_disp = (int *) malloc(sizeof(int) * p->size);
+    int * grant = (int *) malloc(sizeof(int) * p->size);
+    int * allowed = (int *) malloc(sizeof(int) * p->size);
+    snprintf(spill.name,sizeof(spill.name),"%s/bucket_sort.%d.%d.runs",p->spill_dir,(int) getpid(),p->rank);
+    spill.file = NULL;
+    spill.runs = NULL;
+    spill.num_runs = 0;
+    spill.length = 0;
+    for(round = 0; round < rounds; round++)
+    {
+        count = length - round*chunk;
+        count = (count < 0) ? 0 : (count > chunk) ? chunk : count;
+        MPI_File_read_at_all(in,(first + round*chunk)*sizeof(int),keys,count,MPI_INT,MPI_STATUS_IGNORE);
+        timer_phase(&timer,"read");
+        if(p->verify)
+            for(i = 0; i < count; i++)
+                check_in(&check,check_key_int(keys[i]));
+        radix_sort_int(keys,count,p->threads);
+        memset(send_counts,0,sizeof(int) * p->size);
+        for(i = 0; i < count; i++)
+            send_counts[find_bucket(splitters,p->size-1,keys[i])]++;
+        MPI_Alltoall(send_counts,1,MPI_INT,recv_counts,1,MPI_INT,MPI_COMM_WORLD);
+        send_disp[0] = 0;
+        for(i = 1; i < p->size; i++)
+            send_disp[i] = send_disp[i-1] + send_counts[i-1];
+        timer_phase(&timer,"partition");
+        /* A round can bring more keys than fit, so it is received in steps of at most
+           capacity keys: each rank grants its senders room, spilling when it is full */
+        do
+        {
+            for(incoming = 0, i = 0; i < p->size; i++)
+                incoming += recv_counts[i];
+            if(held + incoming > capacity && held > 0)
+            {
+                if(spill.file == NULL && (spill.file = fopen(spill.name,"w+b")) == NULL)
+                {
+                    fprintf(stderr,"Unable to create %s\n",spill.name);
+                    MPI_Abort(MPI_COMM_WORLD,1);
+                }
+                spill_run(&spill,collected,held,p->threads);
+                held = 0;
+                timer_phase(&timer,"sort");
+            }
+            for(room = capacity - held, i = 0; i < p->size; i++)
+            {
+                grant[i] = (recv_counts[i] < room) ? recv_counts[i] : room;
+                room -= grant[i];
+                recv_counts[i] -= grant[i];
+                recv_disp[i] = (i == 0) ? 0 : recv_disp[i-1] + grant[i-1];
+            }
+            MPI_Alltoall(grant,1,MPI_INT,allowed,1,MPI_INT,MPI_COMM_WORLD);
+            MPI_Alltoallv(keys,allowed,send_disp,MPI_INT,collected + held,grant,recv_disp,MPI_INT,MPI_COMM_WORLD);
+            for(i = 0; i < p->size; i++)
+            {
+                send_disp[i] += allowed[i];
+                held += grant[i];
+            }
+            for(pending = 0, i = 0; i < p->size; i++)
+                pending += recv_counts[i];
+            MPI_Allreduce(MPI_IN_PLACE,&pending,1,MPI_LONG,MPI_MAX,MPI_COMM_WORLD);
+        } while(pending > 0);
+        timer_phase(&timer,"exchange");
+    }
+    MPI_File_close(&in);
+    free(keys);
+
+    /* My partition starts after the keys of all lower ranks */
+    total = spill.length + held;
+    MPI_Exscan(&total,&offset,1,MPI_LONG,MPI_SUM,MPI_COMM_WORLD);
+    if(p->rank == 0)
+        offset = 0;
+    if(p->verbose)
+        fprintf(stderr,"[%d] %ld keys in %d runs, written from key %ld\n",p->rank,total,spill.num_runs + (held > 0),offset);
+    if(MPI_File_open(MPI_COMM_WORLD,p->output,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&out) != MPI_SUCCESS)
+    {
+        if(p->rank == 0) fprintf(stderr,"Unable to open %s\n",p->output);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    MPI_File_set_size(out,n*sizeof(int));
+    if(spill.num_runs == 0)
+    {
+        radix_sort_int(collected,held,p->threads);
+        timer_phase(&timer,"sort");
+        MPI_File_write_at(out,offset*sizeof(int),collected,held,MPI_INT,MPI_STATUS_IGNORE);
+        if(p->verify)
+            for(i = 0; i < held; i++)
+                check_out(&check,check_key_int(collected[i]),check_key_int(collected[i]));
+        free(collected);
+    }
+    else
+    {
+        if(held > 0)
+            spill_run(&spill,collected,held,p->threads);
+        free(collected);
+        timer_phase(&timer,"sort");
+        merge_runs(&spill,out,offset,budget,p->verify ? &check : NULL);
+        fclose(spill.file);
+        remove(spill.name);
+    }
+    MPI_File_close(&out);
+    timer_phase(&timer,"write");
+    if(p->verify)
+    {
+        check_finish(&check,MPI_COMM_WORLD);
+        timer_phase(&timer,"verify");
+    }
+    timer_report(&timer,(double) n*sizeof(int),MPI_COMM_WORLD);
+    if(p->rank == 0)
+        fprintf(stderr,"array size: %ld\telapse time: %f\n",n,MPI_Wtime()-start);
+    free(spill.runs);
+    free(splitters);
+    free(send_counts);
+    free(send_disp);
+    free(recv_counts);
+    free(recv_disp);
+    free(grant);
+    free(allowed);
+}
+
+/* Record mode: the input file holds fixed size records that start with their key.
+   Keys are reduced to order preserving 64 bit prefixes by a key_extract function.
+   Only (prefix, record number) tuples are partitioned and sorted; the payload then
+   moves once, straight from the slice it was read into to its place in the output. */
+#define DEFAULT_KEY_SIZE 10
+
+/* Unsigned bytes compared like memcmp, the first 8 form the prefix */
+uint64_t key_bytes(const unsigned char * record, int key_size)
+{
+    uint64_t k = 0;
+    int i;
+    for(i = 0; i < 8; i++)
+        k = (k << 8) | ((i < key_size) ? record[i] : 0);
+    return k;
+}
+
+/* Native integers, signed ones shifted so they order as unsigned */
+uint64_t key_i32(const unsigned char * record, int key_size)
+{
+    int32_t k;
+    memcpy(&k,record,sizeof(k));
+    return (uint32_t) k ^ 0x80000000u;
+}
+
+uint64_t key_i64(const unsigned char * record, int key_size)
+{
+    int64_t k;
+    memcpy(&k,record,sizeof(k));
+    return (uint64_t) k ^ 0x8000000000000000ull;
+}
+
+uint64_t key_u64(const unsigned char * record, int key_size)
+{
+    uint64_t k;
+    memcpy(&k,record,sizeof(k));
+    return k;
+}
+
+/* 64 bit versions of choose_splitters() and find_bucket() for the prefixes */
+uint64_t * choose_splitters_u64(Params * p, uint64_t * sorted, long n)
+{
+    int i;
+    uint64_t * samples = (uint64_t *) malloc(sizeof(uint64_t)*p->size);
+    uint64_t * all = (uint64_t *) malloc(sizeof(uint64_t)*p->size*p->size);
+    uint64_t * splitters = (uint64_t *) malloc(sizeof(uint64_t)*p->size);
+    for(i = 0; i < p->size; i++)
+        samples[i] = sorted[i * n / p->size];
+    MPI_Allgather(samples,p->size,MPI_UINT64_T,all,p->size,MPI_UINT64_T,MPI_COMM_WORLD);
+    radix_sort_u64(all,p->size*p->size,1);
+    for(i = 1; i < p->size; i++)
+        splitters[i-1] = all[i*p->size + p->size/2 - 1];
+    free(samples);
+    free(all);
+    return splitters;
+}
+
+int find_bucket_u64(uint64_t * splitters, int num_splitters, uint64_t x)
+{
+    int low = 0, high = num_splitters, mid;
+    while(low < high)
+    {
+        mid = (low + high)/2;
+        if(splitters[mid] <= x)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/* A tuple is the prefix, the record number in the file and, when prefixes can tie,
+   the rest of the key */
+#define TUPLE_HEAD (2 * sizeof(uint64_t))
+
+/* Tuples whose prefixes tie are ordered by the rest of the key, qsort has no context argument */
+static const unsigned char * tie_tuples;
+static int tie_tuple_size, tie_tail;
+
+int compare_tie(const void * n1, const void * n2)
+{
+    return memcmp(tie_tuples + *(const uint64_t *) n1 * tie_tuple_size + TUPLE_HEAD,
+                  tie_tuples + *(const uint64_t *) n2 * tie_tuple_size + TUPLE_HEAD, tie_tail);
+}
+
+/* The rank whose slice of n records holds record g */
+int record_owner(long g, long n, int size)
+{
+    int r = g * size / n;
+    while(r > 0 && n * r / size > g)
+        r--;
+    while(r < size - 1 && n * (r + 1) / size <= g)
+        r++;
+    return r;
+}
+
+void sort_records(Params * p)
+{
+    MPI_File in, out;
+    MPI_Offset bytes;
+    MPI_Datatype record;
+    double start = MPI_Wtime();
+    long R = p->record_size, n, first, length, i, j, m, offset = 0;
+    uint64_t g;
+    int num_samples;
+    Timer timer;
+    Check check;
+    check_init(&check);
+    timer_start(&timer);
+    if(MPI_File_open(MPI_COMM_WORLD,p->input,MPI_MODE_RDONLY,MPI_INFO_NULL,&in) != MPI_SUCCESS)
+    {
+        if(p->rank == 0) fprintf(stderr,"Unable to open %s\n",p->input);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    MPI_File_get_size(in,&bytes);
+    n = bytes/R;
+    if(bytes % R != 0 || n < p->size)
+    {
+        if(p->rank == 0) fprintf(stderr,"Error: %s is not a whole number of records, or has fewer than there are ranks.\n",p->input);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    MPI_Type_contiguous(R,MPI_BYTE,&record);
+    MPI_Type_commit(&record);
+    first = n*p->rank/p->size;
+    length = n*(p->rank+1)/p->size - first;
+    unsigned char * records = (unsigned char *) malloc(R*length);
+    MPI_File_read_at_all(in,first*R,records,length,record,MPI_STATUS_IGNORE);
+    MPI_File_close(&in);
+    timer_phase(&timer,"read");
+    if(p->verify)
+        for(i = 0; i < length; i++)
+            check_in(&check,check_hash(records + i*R,R));
+
+    /* Splitters from the sorted prefixes of a regular sample of the slice */
+    uint64_t * keys = (uint64_t *) malloc(sizeof(uint64_t)*length);
+    for(i = 0; i < length; i++)
+        keys[i] = p->extract(records + i*R, p->key_size);
+    num_samples = (length < SAMPLES_PER_RANK*p->size) ? length : SAMPLES_PER_RANK*p->size;
+    uint64_t * samples = (uint64_t *) malloc(sizeof(uint64_t)*num_samples);
+    for(i = 0; i < num_samples; i++)
+        samples[i] = keys[i*length/num_samples];
+    radix_sort_u64(samples,num_samples,1);
+    uint64_t * splitters = choose_splitters_u64(p,samples,num_samples);
+    free(samples);
+
+    /* Send every record's tuple to the rank of its prefix */
+    int tail = (p->extract == key_bytes && p->key_size > 8) ? p->key_size - 8 : 0, T = TUPLE_HEAD + tail;
+    MPI_Datatype tuple, * send_types, * recv_types;
+    MPI_Type_contiguous(T,MPI_BYTE,&tuple);
+    MPI_Type_commit(&tuple);
+    int * dest = (int *) malloc(sizeof(int)*length);
+    int * send_counts = (int *) calloc(p->size, sizeof(int));
+    int * send_disp = (int *) malloc(sizeof(int) * p->size);
+    int * recv_counts = (int *) malloc(sizeof(int) * p->size);
+    int * recv_disp = (int *) malloc(sizeof(int) * p->size);
+    int * next = (int *) malloc(sizeof(int) * p->size);
+    for(i = 0; i < length; i++)
+        send_counts[dest[i] = find_bucket_u64(splitters,p->size-1,keys[i])]++;
+    MPI_Alltoall(send_counts,1,MPI_INT,recv_counts,1,MPI_INT,MPI_COMM_WORLD);
+    send_disp[0] = recv_disp[0] = 0;
+    for(i = 1; i < p->size; i++)
+    {
+        send_disp[i] = send_disp[i-1] + send_counts[i-1];
+        recv_disp[i] = recv_disp[i-1] + recv_counts[i-1];
+    }
+    m = recv_disp[p->size-1] + recv_counts[p->size-1];
+    memcpy(next,send_disp,sizeof(int) * p->size);
+    unsigned char * packed = (unsigned char *) malloc((size_t) T*length), * t;
+    for(i = 0; i < length; i++)
+    {
+        t = packed + (size_t) (next[dest[i]]++)*T;
+        /* T need not be a multiple of 8, the fields are copied rather than cast */
+        memcpy(t, &keys[i], sizeof(uint64_t));
+        g = first + i;
+        memcpy(t + sizeof(uint64_t), &g, sizeof(uint64_t));
+        memcpy(t + TUPLE_HEAD, records + i*R + 8, tail);
+    }
+    free(keys);
+    free(dest);
+    timer_phase(&timer,"partition");
+    unsigned char * tuples = (unsigned char *) malloc((size_t) T*m);
+    MPI_Alltoallv(packed,send_counts,send_disp,tuple,tuples,recv_counts,recv_disp,tuple,MPI_COMM_WORLD);
+    free(packed);
+    timer_phase(&timer,"exchange");
+
+    /* Sort (prefix, tuple) pairs, then record k of my output is record number[k] of the file */
+    keys = (uint64_t *) malloc(sizeof(uint64_t)*m);
+    uint64_t * index = (uint64_t *) malloc(sizeof(uint64_t)*m);
+    for(i = 0; i < m; i++)
+    {
+        memcpy(&keys[i], tuples + i*T, sizeof(uint64_t));
+        index[i] = i;
+    }
+    radix_sort_u64_kv(keys,index,m,p->threads);
+    if(tail > 0)
+    {
+        tie_tuples = tuples;
+        tie_tuple_size = T;
+        tie_tail = tail;
+        for(i = 0; i < m; i = j)
+        {
+            for(j = i + 1; j < m && keys[j] == keys[i]; j++);
+            if(j - i > 1)
+                qsort(&index[i],j - i,sizeof(uint64_t),compare_tie);
+        }
+    }
+    for(i = 0; i < m; i++)
+        memcpy(&index[i], tuples + index[i]*T + sizeof(uint64_t), sizeof(uint64_t));
+    free(tuples);
+    timer_phase(&timer,"sort");
+
+    /* Ask the owner of every record for it, grouped by owner and in output order */
+    uint64_t * want = (uint64_t *) malloc(sizeof(uint64_t)*m);
+    MPI_Aint * place = (MPI_Aint *) malloc(sizeof(MPI_Aint)*m);
+    memset(recv_counts,0,sizeof(int) * p->size);
+    for(i = 0; i < m; i++)
+        recv_counts[record_owner(index[i],n,p->size)]++;
+    MPI_Alltoall(recv_counts,1,MPI_INT,send_counts,1,MPI_INT,MPI_COMM_WORLD);
+    send_disp[0] = recv_disp[0] = 0;
+    for(i = 1; i < p->size; i++)
+    {
+        send_disp[i] = send_disp[i-1] + send_counts[i-1];
+        recv_disp[i] = recv_disp[i-1] + recv_counts[i-1];
+    }
+    memcpy(next,recv_disp,sizeof(int) * p->size);
+    for(i = 0; i < m; i++)
+    {
+        j = next[record_owner(index[i],n,p->size)]++;
+        want[j] = index[i];
+        place[j] = (MPI_Aint) i*R;
+    }
+    uint64_t * give = (uint64_t *) malloc(sizeof(uint64_t)*length);
+    MPI_Alltoallv(want,recv_counts,recv_disp,MPI_UINT64_T,give,send_counts,send_disp,MPI_UINT64_T,MPI_COMM_WORLD);
+    /* Record numbers and byte offsets can pass INT_MAX, the datatypes take them as MPI_Aint */
+    MPI_Aint * take = (MPI_Aint *) malloc(sizeof(MPI_Aint)*length);
+    for(i = 0; i < length; i++)
+        take[i] = (MPI_Aint) (give[i] - first)*R;
+
+    /* The requests become indexed datatypes on both sides, so MPI moves each record
+       from my slice directly to its place in the owner's output */
+    send_types = (MPI_Datatype *) malloc(sizeof(MPI_Datatype) * p->size);
+    recv_types = (MPI_Datatype *) malloc(sizeof(MPI_Datatype) * p->size);
+    int * zero = (int *) calloc(p->size, sizeof(int));
+    for(i = 0; i < p->size; i++)
+    {
+        MPI_Type_create_hindexed_block(send_counts[i],1,take + send_disp[i],record,&send_types[i]);
+        MPI_Type_create_hindexed_block(recv_counts[i],1,place + recv_disp[i],record,&recv_types[i]);
+        MPI_Type_commit(&send_types[i]);
+        MPI_Type_commit(&recv_types[i]);
+        send_counts[i] = send_counts[i] > 0;
+        recv_counts[i] = recv_counts[i] > 0;
+    }
+    unsigned char * sorted = (unsigned char *) malloc(R*m);
+    MPI_Alltoallw(records,send_counts,zero,send_types,sorted,recv_counts,zero,recv_types,MPI_COMM_WORLD);
+    for(i = 0; i < p->size; i++)
+    {
+        MPI_Type_free(&send_types[i]);
+        MPI_Type_free(&recv_types[i]);
+    }
+    free(send_types);
+    free(recv_types);
+    free(zero);
+    free(want);
+    free(place);
+    free(give);
+    free(take);
+    free(records);
+    free(index);
+    timer_phase(&timer,"exchange");
+    /* Only the prefixes are checked for order, ties are trusted to the memcmp above */
+    if(p->verify)
+        for(i = 0; i < m; i++)
+            check_out(&check,keys[i],check_hash(sorted + i*R,R));
+    free(keys);
+
+    /* Every rank writes its records after those of the lower ranks */
+    MPI_Exscan(&m,&offset,1,MPI_LONG,MPI_SUM,MPI_COMM_WORLD);
+    if(p->rank == 0)
+        offset = 0;
+    if(p->verbose)
+        fprintf(stderr,"[%d] %ld records, written from record %ld\n",p->rank,m,offset);
+    if(MPI_File_open(MPI_COMM_WORLD,p->output,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&out) != MPI_SUCCESS)
+    {
+        if(p->rank == 0) fprintf(stderr,"Unable to open %s\n",p->output);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    MPI_File_set_size(out,n*R);
+    MPI_File_write_at_all(out,offset*R,sorted,m,record,MPI_STATUS_IGNORE);
+    MPI_File_close(&out);
+    timer_phase(&timer,"write");
+    if(p->verify)
+    {
+        check_finish(&check,MPI_COMM_WORLD);
+        timer_phase(&timer,"verify");
+    }
+    timer_report(&timer,(double) n*R,MPI_COMM_WORLD);
+    if(p->rank == 0)
+        fprintf(stderr,"records: %ld\telapse time: %f\n",n,MPI_Wtime()-start);
+    free(sorted);
+    free(splitters);
+    free(send_counts);
+    free(send_disp);
+    free(recv_counts);
+    free(recv_disp);
+    free(next);
+    MPI_Type_free(&tuple);
+    MPI_Type_free(&record);
+}
+
 void usage()
 {
     printf("bucket_sort\n\
@@ -217,15 +997,25 @@ void usage()
             -r\t\tPrint bucket ranges\n\
             -s <size>\tSpecify array size\n\
             -m <max>\tSpecify largest number in array\n\
+            -k\t\tSkewed keys, crowded towards 0\n\
             -p\t\tPrint the array\n\
+            -i <file>\tSort the ints in file instead, out of core\n\
+            -o <file>\tOutput file for -i\n\
+            -M <MB>\tMemory per rank for -i (default %d)\n\
+            -T <dir>\tDirectory for the sorted runs of -i (default $TMPDIR or /tmp)\n\
+            -R <bytes>\tThe -i file holds records of this size, sorted in memory\n\
+            -K <bytes>\tKey size at the start of each record (default %d)\n\
+            -F <format>\tKey format: bytes (default), i32, i64 or u64\n\
+            -t <threads>\tOpenMP threads per rank for partitioning and sorting\n\
+            -V\t\tVerify the result in parallel\n\
             -v\t\tBe verbose\n\
-            -h\t\tPrint this message\n");
+            -h\t\tPrint this message\n", DEFAULT_MEMORY, DEFAULT_KEY_SIZE);
 }
 /* Parse user arguments */
 void parse_args(int argc, char ** argv, Params * p)
 {
     int c = 0;
-    while((c = getopt(argc,argv,"rs:hm:vp")) != -1)
+    while((c = getopt(argc,argv,"rs:hm:vVpki:o:M:T:R:K:F:t:")) != -1)
     {
         switch(c)
         {
@@ -247,6 +1037,43 @@ void parse_args(int argc, char ** argv, Params * p)
             case 'v':
                 p->verbose = 1;
                 break;
+            case 'k':
+                p->skewed = 1;
+                break;
+            case 'V':
+                p->verify = 1;
+                break;
+            case 't':
+                p->threads = atoi(optarg);
+                break;
+            case 'i':
+                p->input = optarg;
+                break;
+            case 'o':
+                p->output = optarg;
+                break;
+            case 'M':
+                p->memory = atol(optarg) << 20;
+                break;
+            case 'T':
+                p->spill_dir = optarg;
+                break;
+            case 'R':
+                p->record_size = atoi(optarg);
+                break;
+            case 'K':
+                p->key_size = atoi(optarg);
+                break;
+            case 'F':
+                if(strcmp(optarg,"i32") == 0)
+                    p->extract = key_i32, p->key_size = 4;
+                else if(strcmp(optarg,"i64") == 0)
+                    p->extract = key_i64, p->key_size = 8;
+                else if(strcmp(optarg,"u64") == 0)
+                    p->extract = key_u64, p->key_size = 8;
+                else
+                    p->extract = key_bytes;
+                break;
             default:
                 break;
         }
@@ -259,8 +1086,9 @@ int main(int argc, char *argv[])
 {
     int rank;
     int size;
-    /* Initialize MPI */
-    if(MPI_Init(&argc, &argv) != MPI_SUCCESS)
+    int provided;
+    /* Initialize MPI, only the main thread makes MPI calls */
+    if(MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided) != MPI_SUCCESS)
     {
         fprintf(stderr, "Unable to initialize MPI!\n");
         return -1;
@@ -276,12 +1104,45 @@ int main(int argc, char *argv[])
     p.verbose = 0;
     p.print_array = 0;
     p.print_ranges = 0;
+    p.skewed = 0;
+    p.verify = 0;
+    p.threads = 1;
+    p.input = p.output = NULL;
+    p.spill_dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    p.memory = (long) DEFAULT_MEMORY << 20;
+    p.record_size = 0;
+    p.key_size = DEFAULT_KEY_SIZE;
+    p.extract = key_bytes;
     p.rank = rank;
     p.size = size;
     p.array_size = DEFAULT_ARRAY_SIZE;
     p.max_num = MAX_NUM_SIZE;
     /* Check for user options */
     parse_args(argc,argv,&p);
+    if(p.threads > 1 && provided < MPI_THREAD_FUNNELED)
+    {
+        if(rank == 0) fprintf(stderr,"MPI library lacks MPI_THREAD_FUNNELED, using one thread per rank\n");
+        p.threads = 1;
+    }
+    if(p.input)
+    {
+        if(p.output == NULL)
+        {
+            if(rank == 0) fprintf(stderr,"Error: -i needs an output file (-o).\n");
+            exit(1);
+        }
+        if(p.record_size > 0 && p.record_size < p.key_size)
+        {
+            if(rank == 0) fprintf(stderr,"Error: records are smaller than their keys.\n");
+            exit(1);
+        }
+        if(p.record_size > 0)
+            sort_records(&p);
+        else
+            out_of_core(&p);
+        MPI_Finalize();
+        return 0;
+    }
     if(p.array_size % p.size != 0)
     {
         if(rank == 0) fprintf(stderr,"Error: Array size must be multiple of number of ranks.\n");
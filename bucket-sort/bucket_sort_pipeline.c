@@ -9,11 +9,16 @@
 #include<mpi.h>
 #include<math.h>
 #include<time.h>
+#ifdef MEMWATCH
 #include "memwatch.h"
+#endif
+#include "radix_sort.h"
+#include "check.h"
 #define TERM_TAG 5
 #define NUM_TAG 10
 #define DEFAULT_ARRAY_SIZE 500
 #define MAX_NUM_SIZE 30
+#define DEFAULT_BATCH 1024
 #define BLOCK_LOW(id,p,n) ((id)*(n)/(p))
 #define BLOCK_HIGH(id,p,n) \
     (BLOCK_LOW((id)+1,p,n)-1)
@@ -21,7 +26,7 @@
 /* Struct to hold configuration options */
 typedef struct
 {
-    int rank,size, array_size,slice,max_num,verbose;
+    int rank,size, array_size,slice,max_num,verbose,batch,verify;
 } Params;
 
 /* Struct defining a bucket, that contains index items */
@@ -38,10 +43,55 @@ void bucket_insert(Bucket * b, int x)
     b->index = b->index +1;
 }
 
-/* Function to compare two values for sorting, needed for quick sort */
-int compare( const void * n1, const void * n2)
+/* Numbers on their way to the next stage.
+   One buffer fills while the other is being sent, so a stage keeps working while its
+   last batch is on the wire. */
+typedef struct
+{
+    int * buffer[2];
+    MPI_Request request[2];
+    int current, fill, batch, dest;
+} Outbox;
+
+void outbox_init(Outbox * o, int batch, int dest)
 {
-    return (*(int*)n1 - *(int*)n2);
+    int i;
+    for(i = 0; i < 2; i++)
+    {
+        o->buffer[i] = (int *) malloc(sizeof(int) * batch);
+        o->request[i] = MPI_REQUEST_NULL;
+    }
+    o->current = o->fill = 0;
+    o->batch = batch;
+    o->dest = dest;
+}
+
+/* Send the current buffer and switch to the other one once its send has completed */
+void outbox_flush(Outbox * o)
+{
+    if(o->fill == 0)
+        return;
+    MPI_Isend(o->buffer[o->current], o->fill, MPI_INT, o->dest, NUM_TAG, MPI_COMM_WORLD, &o->request[o->current]);
+    o->current ^= 1;
+    o->fill = 0;
+    MPI_Wait(&o->request[o->current], MPI_STATUS_IGNORE);
+}
+
+void outbox_put(Outbox * o, int x)
+{
+    o->buffer[o->current][o->fill++] = x;
+    if(o->fill == o->batch)
+        outbox_flush(o);
+}
+
+/* Send what is left, then the termination message, which MPI delivers after the data */
+void outbox_close(Outbox * o)
+{
+    outbox_flush(o);
+    MPI_Waitall(2, o->request, MPI_STATUSES_IGNORE);
+    MPI_Send(NULL, 0, MPI_INT, o->dest, TERM_TAG, MPI_COMM_WORLD);
+    free(o->buffer[0]);
+    free(o->buffer[1]);
 }
 
 
@@ -58,58 +108,70 @@ void slave(Params * p)
     int count = 0;
     int done = 0;
     int temp = 0;
+    int received, j;
     int low = BLOCK_LOW(p->rank-1,p->size,p->max_num+1);
     int high = BLOCK_HIGH(p->rank-1,p->size,p->max_num+1);
+    // numbers travel in batches, the last stage has nobody to pass them to
+    Outbox out;
+    int * batch = (int *) malloc(sizeof(int) * p->batch);
+    if(p->rank != p->size)
+        outbox_init(&out, p->batch, p->rank+1);
+    // phase timings and verification
+    Timer timer;
+    Check check;
+    check_init(&check);
+    timer_start(&timer);
     start = MPI_Wtime();
-    // Repeat until done
-    while(!done)
+    // Master work: generate the list and send it up the pipeline to rank 1
+    if(p->rank == 0)
     {
-        // Master work
-        if(p->rank == 0)
+        for(count = 0; count < p->array_size; count++)
         {
-            // Increase count until array_size
-            if(count++ < p->array_size)
-            {
-                // Add random number to list, send it up the pipeline to rank 1
-                temp = rand() % p->max_num;
-                MPI_Send(&temp, 1, MPI_INT, 1, NUM_TAG, MPI_COMM_WORLD);
-            }
-            else
-            {
-                // Signal end of the list
-                MPI_Send(&temp, 1, MPI_INT, 1, TERM_TAG, MPI_COMM_WORLD);
-                done = 1;
-            }
+            temp = rand() % p->max_num;
+            if(p->verify)
+                check_in(&check, check_key_int(temp));
+            outbox_put(&out, temp);
         }
-        // Slave work
-        else
+        // Signal end of the list
+        outbox_close(&out);
+        count = 0;
+    }
+    // Slave work
+    else
+    {
+        // Repeat until done
+        while(!done)
         {
-            // receive a number from the previous stage
-            MPI_Recv(&temp, 1, MPI_INT, p->rank-1, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            // receive a batch from the previous stage
+            MPI_Recv(batch, p->batch, MPI_INT, p->rank-1, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
             // check for termination
             if(status.MPI_TAG == TERM_TAG)
             {
                 // make sure I'm sending to a valid rank and foward termination
                 done = 1;
                 if(p->rank != p->size)
-                {
-                    MPI_Send(&temp, 1, MPI_INT, p->rank+1, TERM_TAG, MPI_COMM_WORLD);
-                }
+                    outbox_close(&out);
             }
-            // got number
+            // got numbers
             else if(status.MPI_TAG == NUM_TAG)
             {
-                // check to see if I keep it
-                if(temp >= low && temp <= high)
-                    array[count++] = temp;
-                else
-                    // pass it on
-                    MPI_Send(&temp, 1, MPI_INT, p->rank+1, NUM_TAG,MPI_COMM_WORLD); 
+                MPI_Get_count(&status, MPI_INT, &received);
+                for(j = 0; j < received; j++)
+                {
+                    temp = batch[j];
+                    // check to see if I keep it
+                    if(temp >= low && temp <= high)
+                        array[count++] = temp;
+                    else
+                        // pass it on
+                        outbox_put(&out, temp);
+                }
             }
-
         }
     }
+    free(batch);
     MPI_Barrier(MPI_COMM_WORLD);
+    timer_phase(&timer, "stream");
     int * sizes = (int *) calloc(p->size+1,sizeof(int));
     MPI_Gather(&count, 1, MPI_INT, sizes, 1, MPI_INT, 0 , MPI_COMM_WORLD);
     int * disp = (int *) calloc(p->size+1,sizeof(int));
@@ -125,10 +187,21 @@ void slave(Params * p)
     }
     // sort the array, except for the master
     if(p->rank != 0) 
-        qsort(array,count,sizeof(int),compare);
+        radix_sort_int(array,count,1);
     if(p->rank == 0) count = 0;
+    timer_phase(&timer, "sort");
+    // the ranges grow with the rank, so the buckets can be checked where they are
+    if(p->verify)
+    {
+        for(i = 0; i < count; i++)
+            check_out(&check, check_key_int(array[i]), check_key_int(array[i]));
+        check_finish(&check, MPI_COMM_WORLD);
+        timer_phase(&timer, "verify");
+    }
     // gather results
     MPI_Gatherv(array, count, MPI_INT, &array[0], sizes, disp, MPI_INT,0,MPI_COMM_WORLD);
+    timer_phase(&timer, "gather");
+    timer_report(&timer, (double) p->array_size*sizeof(int), MPI_COMM_WORLD);
     // stop the clock, print results
     end = MPI_Wtime();
     if(p->rank ==0) fprintf(stderr,"[%d] Elapsed time: %f\n",p->rank,end-start);
@@ -144,15 +217,17 @@ void usage()
             -r\t\tPrint bucket ranges\n\
             -s <size>\tSpecify array size\n\
             -m <max>\tSpecify largest number in array\n\
+            -b <size>\tNumbers per message (default %d)\n\
             -p\t\tPrint the array\n\
+            -V\t\tVerify the result in parallel\n\
             -v\t\tBe verbose\n\
-            -h\t\tPrint this message\n");
+            -h\t\tPrint this message\n", DEFAULT_BATCH);
 }
 /* Parse user arguments */
 void parse_args(int argc, char ** argv, Params * p)
 {
     int c = 0;
-    while((c = getopt(argc,argv,"s:hm:v")) != -1)
+    while((c = getopt(argc,argv,"s:hm:vVb:")) != -1)
     {
         switch(c)
         {
@@ -168,6 +243,22 @@ void parse_args(int argc, char ** argv, Params * p)
             case 'v':
                 p->verbose = 1;
                 break;
+            case 'b':
+                p->batch = atoi(optarg);
+                if(p->batch <= 0)
+                {
+                    if(p->rank == 0)
+                    {
+                        fprintf(stderr,"-b must be at least 1\n");
+                        usage();
+                    }
+                    MPI_Finalize();
+                    exit(1);
+                }
+                break;
+            case 'V':
+                p->verify = 1;
+                break;
             default:
                 break;
         }
@@ -203,6 +294,8 @@ int main(int argc, char *argv[])
     
     p.array_size = DEFAULT_ARRAY_SIZE;
     p.max_num = MAX_NUM_SIZE;
+    p.batch = DEFAULT_BATCH;
+    p.verify = 0;
     /* Check for user options */
     parse_args(argc,argv,&p);
     slave(&p);
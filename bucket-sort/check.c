@@ -0,0 +1,106 @@
+/* File: check.c
+   Purpose: Parallel verification and per phase timing, see check.h
+   */
+
+#include<stdio.h>
+#include<string.h>
+#include "check.h"
+
+void check_init(Check * c)
+{
+    c->input = c->output = 0;
+    c->count_in = c->count_out = 0;
+    c->first = c->last = 0;
+    c->disorder = 0;
+}
+
+uint64_t check_hash(const unsigned char * data, long n)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    long i;
+    for(i = 0; i < n; i++)
+        h = (h ^ data[i]) * 0x100000001b3ull;
+    return h;
+}
+
+int check_finish(Check * c, MPI_Comm comm)
+{
+    int rank;
+    uint64_t before = 0, mine = c->count_out ? c->last : 0, sums[2], total_sums[2];
+    long counts[3], total_counts[3];
+    MPI_Comm_rank(comm, &rank);
+    /* The largest key on the lower ranks, which also looks past ranks without output */
+    MPI_Exscan(&mine, &before, 1, MPI_UINT64_T, MPI_MAX, comm);
+    if(rank > 0 && c->count_out && c->first < before)
+        c->disorder++;
+    sums[0] = c->input;
+    sums[1] = c->output;
+    counts[0] = c->count_in;
+    counts[1] = c->count_out;
+    counts[2] = c->disorder;
+    /* Unsigned sums wrap around, which keeps them independent of the order of the keys */
+    MPI_Allreduce(sums, total_sums, 2, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Allreduce(counts, total_counts, 3, MPI_LONG, MPI_SUM, comm);
+    if(rank == 0)
+    {
+        if(total_counts[2] == 0 && total_counts[0] == total_counts[1] && total_sums[0] == total_sums[1])
+            fprintf(stderr,"Verified: %ld keys in order, checksums match\n",total_counts[1]);
+        else
+            fprintf(stderr,"Verification FAILED: %ld keys out of order, %ld keys in, %ld keys out, checksums %s\n",
+                    total_counts[2],total_counts[0],total_counts[1],(total_sums[0] == total_sums[1]) ? "match" : "differ");
+    }
+    return total_counts[2] == 0 && total_counts[0] == total_counts[1] && total_sums[0] == total_sums[1];
+}
+
+void timer_start(Timer * t)
+{
+    t->count = 0;
+    t->start = t->mark = MPI_Wtime();
+}
+
+/* Index of the phase called name, added with no time if it is new, -1 when full */
+static int timer_find(Timer * t, const char * name)
+{
+    int i;
+    for(i = 0; i < t->count && strcmp(t->names[i], name) != 0; i++);
+    if(i < t->count)
+        return i;
+    if(t->count == MAX_PHASES)
+        return -1;
+    t->names[t->count] = name;
+    t->seconds[t->count] = 0;
+    return t->count++;
+}
+
+void timer_declare(Timer * t, const char * name)
+{
+    timer_find(t, name);
+}
+
+void timer_phase(Timer * t, const char * name)
+{
+    double now = MPI_Wtime();
+    /* Phases that repeat, like the rounds of the out of core sort, add up */
+    int i = timer_find(t, name);
+    if(i >= 0)
+        t->seconds[i] += now - t->mark;
+    t->mark = now;
+}
+
+void timer_report(Timer * t, double bytes, MPI_Comm comm)
+{
+    double slowest[MAX_PHASES + 1], local[MAX_PHASES + 1];
+    int rank, i;
+    MPI_Comm_rank(comm, &rank);
+    for(i = 0; i < t->count; i++)
+        local[i] = t->seconds[i];
+    local[t->count] = t->mark - t->start;
+    MPI_Reduce(local, slowest, t->count + 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    if(rank == 0)
+    {
+        for(i = 0; i < t->count; i++)
+            fprintf(stderr,"%-10s %f s\n",t->names[i],slowest[i]);
+        fprintf(stderr,"%-10s %f s\t%.3f GB/s\n","total",slowest[t->count],
+                (slowest[t->count] > 0) ? bytes / slowest[t->count] / 1e9 : 0.0);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef CHECK_H
+#define CHECK_H
+/*
+ * File: check.h
+ * Purpose: Parallel verification and per phase timing for the bucket sorts.
+   Every rank feeds the keys it starts with to check_in() and its part of the result, in
+   order, to check_out().  check_finish() then verifies without a serial pass:
+   each part is in order, no rank starts below the largest key of the ranks before it,
+   and the input and output are the same multiset (same count and same sum of hashed keys). */
+#include <stdint.h>
+#include <mpi.h>
+
+typedef struct
+{
+    uint64_t input, output;     /* sums of hashed values */
+    long count_in, count_out;
+    uint64_t first, last;       /* first and last key of the output */
+    long disorder;              /* keys smaller than the one before */
+} Check;
+
+/* Keys are order preserving unsigned versions, see check_key_int() */
+static inline uint64_t check_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t check_key_int(int x)
+{
+    return (uint32_t) x ^ 0x80000000u;
+}
+
+static inline void check_in(Check * c, uint64_t value)
+{
+    c->input += check_mix(value);
+    c->count_in++;
+}
+
+/* key decides the order, value goes into the checksum (the key itself, or a record hash) */
+static inline void check_out(Check * c, uint64_t key, uint64_t value)
+{
+    if(c->count_out == 0)
+        c->first = key;
+    else if(key < c->last)
+        c->disorder++;
+    c->last = key;
+    c->output += check_mix(value);
+    c->count_out++;
+}
+
+void check_init(Check * c);
+
+/* 64 bit FNV-1a of a whole record */
+uint64_t check_hash(const unsigned char * data, long n);
+
+/* Collective, returns 1 on every rank if the distributed output is the sorted input */
+int check_finish(Check * c, MPI_Comm comm);
+
+/* Wall time of consecutive phases.  timer_report() matches the phases of the ranks by
+   position, so they must be first seen in the same order everywhere: a phase that only
+   some ranks reach, or reach in a different order, is declared up front */
+#define MAX_PHASES 8
+typedef struct
+{
+    int count;
+    const char * names[MAX_PHASES];
+    double seconds[MAX_PHASES];
+    double start, mark;
+} Timer;
+
+void timer_start(Timer * t);
+
+/* Adds a phase with no time yet, without ending the current one */
+void timer_declare(Timer * t, const char * name);
+
+/* Ends the phase that began at the last call (or timer_start), time for a name that was
+   used before is added to it */
+void timer_phase(Timer * t, const char * name);
+
+/* Collective, rank 0 prints the slowest rank's time for every phase and the throughput */
+void timer_report(Timer * t, double bytes, MPI_Comm comm);
+
+#endif
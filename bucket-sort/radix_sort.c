@@ -0,0 +1,145 @@
+/* File: radix_sort.c
+   Purpose: LSD radix sort, see radix_sort.h
+   */
+
+#include<stdlib.h>
+#include<string.h>
+#ifdef _OPENMP
+#include<omp.h>
+#endif
+#include "radix_sort.h"
+
+/* Below this many keys an 8 bit histogram is cheaper to clear and scan */
+#define RADIX_SMALL (1L << 16)
+
+static inline uint64_t radix_key(const void * keys, int key_size, long i)
+{
+    return (key_size == 4) ? ((const uint32_t *) keys)[i] : ((const uint64_t *) keys)[i];
+}
+
+static inline void radix_store(void * array, int size, long i, uint64_t x)
+{
+    if(size == 4)
+        ((uint32_t *) array)[i] = (uint32_t) x;
+    else
+        ((uint64_t *) array)[i] = x;
+}
+
+/* Keys and values are 4 or 8 bytes, value_size is 0 without values */
+static void radix_sort(void * keys, void * values, int key_size, int value_size, long n, int threads)
+{
+    int bits = (n < RADIX_SMALL) ? 8 : 11, shift, skip;
+    long buckets = 1L << bits, mask = buckets - 1;
+    long * counts;
+    void * src_keys = keys, * dst_keys, * src_values = values, * dst_values = NULL, * swap;
+#ifndef _OPENMP
+    threads = 1;
+#endif
+    if(threads < 1)
+        threads = 1;
+    if(n < 2)
+        return;
+    counts = (long *) malloc(sizeof(long) * buckets * threads);
+    dst_keys = malloc(n * key_size);
+    if(value_size)
+        dst_values = malloc(n * value_size);
+    for(shift = 0; shift < 8 * key_size; shift += bits)
+    {
+        skip = 0;
+#pragma omp parallel num_threads(threads)
+        {
+            /* The runtime may give fewer threads than asked for, slice by the real team */
+            int t = 0, team = 1, u;
+            long i, d, low, high, sum, x, * c;
+#ifdef _OPENMP
+            t = omp_get_thread_num();
+            team = omp_get_num_threads();
+#endif
+            low = n * t / team;
+            high = n * (t + 1) / team;
+            c = counts + t * buckets;
+            memset(c, 0, sizeof(long) * buckets);
+            for(i = low; i < high; i++)
+                c[(radix_key(src_keys, key_size, i) >> shift) & mask]++;
+#pragma omp barrier
+#pragma omp single
+            {
+                /* Thread t puts its keys with digit d after all smaller digits and after
+                   digit d of the lower threads, which keeps the sort stable */
+                for(sum = 0, d = 0; d < buckets; d++)
+                {
+                    if(sum == 0)
+                    {
+                        for(x = 0, u = 0; u < team; u++)
+                            x += counts[u * buckets + d];
+                        if(x == n)
+                            skip = 1;
+                    }
+                    for(u = 0; u < team; u++)
+                    {
+                        x = counts[u * buckets + d];
+                        counts[u * buckets + d] = sum;
+                        sum += x;
+                    }
+                }
+            }
+            if(!skip)
+                for(i = low; i < high; i++)
+                {
+                    uint64_t k = radix_key(src_keys, key_size, i);
+                    long pos = c[(k >> shift) & mask]++;
+                    radix_store(dst_keys, key_size, pos, k);
+                    if(value_size)
+                        radix_store(dst_values, value_size, pos, radix_key(src_values, value_size, i));
+                }
+        }
+        /* Every key has the same digit, the pass would not move anything */
+        if(skip)
+            continue;
+        swap = src_keys, src_keys = dst_keys, dst_keys = swap;
+        swap = src_values, src_values = dst_values, dst_values = swap;
+    }
+    /* After an odd number of passes the result is in the scratch arrays */
+    if(src_keys != keys)
+    {
+        memcpy(keys, src_keys, n * key_size);
+        if(value_size)
+            memcpy(values, src_values, n * value_size);
+        dst_keys = src_keys;
+        dst_values = src_values;
+    }
+    free(dst_keys);
+    free(dst_values);
+    free(counts);
+}
+
+void radix_sort_u32(uint32_t * keys, long n, int threads)
+{
+    radix_sort(keys, NULL, 4, 0, n, threads);
+}
+
+void radix_sort_u64(uint64_t * keys, long n, int threads)
+{
+    radix_sort(keys, NULL, 8, 0, n, threads);
+}
+
+void radix_sort_u32_kv(uint32_t * keys, uint32_t * values, long n, int threads)
+{
+    radix_sort(keys, values, 4, 4, n, threads);
+}
+
+void radix_sort_u64_kv(uint64_t * keys, uint64_t * values, long n, int threads)
+{
+    radix_sort(keys, values, 8, 8, n, threads);
+}
+
+void radix_sort_int(int * keys, long n, int threads)
+{
+    uint32_t * k = (uint32_t *) keys;
+    long i;
+    for(i = 0; i < n; i++)
+        k[i] ^= 0x80000000u;
+    radix_sort(k, NULL, 4, 0, n, threads);
+    for(i = 0; i < n; i++)
+        k[i] ^= 0x80000000u;
+}
@@ -0,0 +1,22 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+/*
+ * File: radix_sort.h
+ * Purpose: LSD radix sort used as the local sort of the bucket sorts.
+   One counting pass per digit (11 bits, 8 for short arrays so the histogram stays small),
+   digits on which all keys agree are skipped.  The sort is stable and can move a
+   value along with every key.  With threads > 1 every pass is split over OpenMP threads,
+   each thread scatters its own part of the array through its own histogram. */
+#include <stdint.h>
+
+void radix_sort_u32(uint32_t * keys, long n, int threads);
+void radix_sort_u64(uint64_t * keys, long n, int threads);
+
+/* Sort keys, applying the same permutation to values */
+void radix_sort_u32_kv(uint32_t * keys, uint32_t * values, long n, int threads);
+void radix_sort_u64_kv(uint64_t * keys, uint64_t * values, long n, int threads);
+
+/* Signed keys, ordered by flipping the sign bit */
+void radix_sort_int(int * keys, long n, int threads);
+
+#endif
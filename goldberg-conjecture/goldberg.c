@@ -5,40 +5,538 @@
 */
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
 #include<omp.h>
 #include<sys/time.h>
 #include<math.h>
 #include<time.h>
 #include<unistd.h>
+#include<string.h>
+#ifdef USE_MPI
+#include<mpi.h>
+#endif
 #define MAX 500
 #define MIN 2
 
-// returns 1 if number p is prime, 0 otherwise
-int prime(int p)
-{
-    int result = 1;
-    int i;
-    for(i = 2; i < sqrt(p); i++)
-	if(p % i == 0)
-	{
-	    result = 0;
-	    break;
-	}
-    return result;
+/* Bits per sieve segment, a segment fits in the L1/L2 cache */
+#define SEGMENT_BITS (1 << 18)
+/* Largest partition prime looked up in a rank's window, no even number below 4e18 needs one
+   above 9781; anything larger falls back to trial division */
+#define WITNESS_BOUND (1 << 16)
+
+/* Bit packed sieve of the odd numbers in [low,max]: bit k is set if low+2k+1 is prime */
+typedef struct
+{
+    uint64_t * bits;
+    long low, max;
+} Sieve;
+
+// returns 1 if number p is prime, 0 otherwise, p must lie in the sieve
+static inline int prime(const Sieve * s, long p)
+{
+    if(p < 3)
+        return p == 2;
+    if(!(p & 1))
+        return 0;
+    return (s->bits[((p - s->low) >> 1) >> 6] >> (((p - s->low) >> 1) & 63)) & 1;
+}
+
+// primality of any p, using the window if it covers p, else the base sieve or trial division by it
+static inline int prime_any(const Sieve * base, const Sieve * window, long p)
+{
+    long i;
+    if(p >= window->low && p <= window->max)
+        return prime(window, p);
+    if(p <= base->max)
+        return prime(base, p);
+    if(!(p & 1))
+        return 0;
+    for(i = 3; i * i <= p; i += 2)
+        if(prime(base, i) && p % i == 0)
+            return 0;
+    return 1;
+}
+
+/* Segmented Sieve of Eratosthenes of [low,max].
+   The base primes up to sqrt(max) are sieved first, then every segment is sieved on its
+   own (in parallel) so the bits being cleared stay in cache. */
+void sieve_init(Sieve * s, long low, long max)
+{
+    long words, nbits, root = (long) sqrt((double) max) + 1, i, j, seg;
+    char * base = (char *) calloc(root + 1, 1);
+    long * primes = (long *) malloc(sizeof(long) * (root + 1));
+    long nprimes = 0;
+    /* Segments start on word boundaries so threads never share a word */
+    s->low = (low < 0) ? 0 : low - low % 128;
+    s->max = max;
+    words = (((max - s->low) >> 1) >> 6) + 1;
+    nbits = words * 64;
+    s->bits = (uint64_t *) malloc(sizeof(uint64_t) * words);
+    for(i = 3; i <= root; i += 2)
+        if(!base[i])
+        {
+            primes[nprimes++] = i;
+            for(j = i * i; j <= root; j += 2 * i)
+                base[j] = 1;
+        }
+#pragma omp parallel for private(i, j) schedule(dynamic)
+    for(seg = 0; seg < nbits; seg += SEGMENT_BITS)
+    {
+        long end = (seg + SEGMENT_BITS < nbits) ? seg + SEGMENT_BITS : nbits, k, m;
+        for(k = seg / 64; k < end / 64; k++)
+            s->bits[k] = ~0ULL;
+        /* Clear the odd multiples of p from max(p*p, start of segment), they are p bits apart */
+        for(i = 0; i < nprimes; i++)
+        {
+            long p = primes[i];
+            m = s->low + 2 * seg + 1;
+            if(m < p * p)
+                m = p * p;
+            m = ((m + p - 1) / p) * p;
+            if(!(m & 1))
+                m += p;
+            for(j = (m - s->low) >> 1; j < end; j += p)
+                s->bits[j >> 6] &= ~(1ULL << (j & 63));
+        }
+    }
+    /* 1 is not prime */
+    if(s->low == 0)
+        s->bits[0] &= ~1ULL;
+    free(base);
+    free(primes);
 }
 
-// returns the number of combinations of primes that equal p
-int gold(int p)
+// returns the number of ways p can be written as the sum of two primes q <= p-q
+long gold(const Sieve * s, long p)
 {
-    int result = 0;
-    int i,j;
-    for(i=0;i<p;i++)
-	if(prime(i))
-	    for(j=0;j<p;j++)
-		if(prime(j) && (i+j) == p)
-		    result++;
+    long result = 0;
+    long i;
+    if(prime(s, 2) && prime(s, p - 2))
+        result++;
+    for(i = 3; i <= p / 2; i += 2)
+        if(prime(s, i) && prime(s, p - i))
+            result++;
     return result;
 }
+
+// returns the smallest prime q with p-q prime, 0 if there is none
+long gold_witness(const Sieve * base, const Sieve * window, long p)
+{
+    long i;
+    if(prime_any(base, window, p - 2))
+        return 2;
+    for(i = 3; i <= p / 2; i += 2)
+    {
+        /* The small candidate is nearly always in the base sieve */
+        if(!(i <= base->max ? prime(base, i) : prime_any(base, window, i)))
+            continue;
+        if(prime_any(base, window, p - i))
+            return i;
+    }
+    return 0;
+}
+
+/* Number theoretic transform over the prime P = 2^64 - 2^32 + 1.
+   Every partition count is far below P, so the convolution of the prime indicator with
+   itself is exact, and P supports transforms of up to 2^32 points. */
+#define NTT_P 0xFFFFFFFF00000001ULL
+#define NTT_ROOT 7
+/* Stages whose butterflies stay inside a block of this many points are done block by block */
+#define NTT_BLOCK (1 << 14)
+
+static inline uint64_t ntt_add(uint64_t a, uint64_t b)
+{
+    uint64_t r = a + b;
+    /* On overflow 2^64 = 2^32 - 1 (mod P) */
+    if(r < a || r >= NTT_P)
+        r -= NTT_P;
+    return r;
+}
+
+static inline uint64_t ntt_sub(uint64_t a, uint64_t b)
+{
+    return (a >= b) ? a - b : a + (NTT_P - b);
+}
+
+/* a*b mod P without division, using 2^64 = 2^32 - 1 and 2^96 = -1 (mod P) */
+static inline uint64_t ntt_mul(uint64_t a, uint64_t b)
+{
+    unsigned __int128 x = (unsigned __int128) a * b;
+    uint64_t lo = (uint64_t) x, hi = (uint64_t) (x >> 64);
+    uint64_t hh = hi >> 32, hl = hi & 0xFFFFFFFFULL, t, r;
+    t = lo - hh;
+    if(lo < hh)
+        t -= 0xFFFFFFFFULL;
+    r = t + hl * 0xFFFFFFFFULL;
+    if(r < t)
+        r += 0xFFFFFFFFULL;
+    return (r >= NTT_P) ? r - NTT_P : r;
+}
+
+static uint64_t ntt_pow(uint64_t a, uint64_t e)
+{
+    uint64_t r = 1;
+    for(; e; e >>= 1, a = ntt_mul(a, a))
+        if(e & 1)
+            r = ntt_mul(r, a);
+    return r;
+}
+
+/* Butterflies k in [from,to) of the stage with half length len; butterfly k pairs
+   element s+j with s+j+len where s = 2*len*(k/len) and j = k%len */
+static void ntt_butterflies(uint64_t * a, const uint64_t * tw, long n, long len, long from, long to, int inverse)
+{
+    long k, s, j, stride = n / (2 * len);
+    uint64_t u, v, w;
+    for(k = from; k < to; k++)
+    {
+        s = 2 * len * (k / len);
+        j = k % len;
+        /* w^-i = -w^(n/2-i) */
+        w = (!inverse || j == 0) ? tw[j * stride] : NTT_P - tw[n / 2 - j * stride];
+        u = a[s + j];
+        v = a[s + j + len];
+        if(inverse)
+        {
+            v = ntt_mul(v, w);
+            a[s + j] = ntt_add(u, v);
+            a[s + j + len] = ntt_sub(u, v);
+        }
+        else
+        {
+            a[s + j] = ntt_add(u, v);
+            a[s + j + len] = ntt_mul(ntt_sub(u, v), w);
+        }
+    }
+}
+
+/* One stage that spans more than a block, split over the threads by butterfly */
+static void ntt_wide_stage(uint64_t * a, const uint64_t * tw, long n, long len, int inverse)
+{
+    long k;
+#pragma omp parallel for schedule(static)
+    for(k = 0; k < n / 2; k += NTT_BLOCK / 2)
+        ntt_butterflies(a, tw, n, len, k, k + NTT_BLOCK / 2, inverse);
+}
+
+/* In place transform of n (a power of two) points.
+   The forward transform is decimation in frequency and leaves the result in bit reversed
+   order, the inverse is decimation in time and takes it back, so no reordering is needed.
+   Stages that stay inside a block are done block by block so the block stays in cache
+   for all of them. */
+void ntt(uint64_t * a, const uint64_t * tw, long n, int inverse)
+{
+    long len, b, k, block = (n < NTT_BLOCK) ? n : NTT_BLOCK;
+    uint64_t scale;
+    if(!inverse)
+        for(len = n / 2; len >= block; len /= 2)
+            ntt_wide_stage(a, tw, n, len, 0);
+#pragma omp parallel for private(len) schedule(static)
+    for(b = 0; b < n; b += block)
+    {
+        /* The butterflies of block b are numbered from b/2 in every stage */
+        if(!inverse)
+            for(len = block / 2; len >= 1; len /= 2)
+                ntt_butterflies(a, tw, n, len, b / 2, (b + block) / 2, 0);
+        else
+            for(len = 1; len <= block / 2; len *= 2)
+                ntt_butterflies(a, tw, n, len, b / 2, (b + block) / 2, 1);
+    }
+    if(inverse)
+    {
+        for(len = block; len < n; len *= 2)
+            ntt_wide_stage(a, tw, n, len, 1);
+        scale = ntt_pow(n % NTT_P, NTT_P - 2);
+#pragma omp parallel for schedule(static)
+        for(k = 0; k < n; k++)
+            a[k] = ntt_mul(a[k], scale);
+    }
+}
+
+/* r(p) for every even p <= max in one convolution: with a[i] = 1 for prime i,
+   (a*a)[p] counts ordered pairs, r(p) = ((a*a)[p] + a[p/2]) / 2 */
+void gold_all(const Sieve * s, long max, long * counts)
+{
+    long n = 1, i;
+    uint64_t * a, * tw, w;
+    while(n < 2 * max + 1)
+        n *= 2;
+    a = (uint64_t *) calloc(n, sizeof(uint64_t));
+    tw = (uint64_t *) malloc(sizeof(uint64_t) * (n / 2));
+    w = ntt_pow(NTT_ROOT, (NTT_P - 1) / n);
+    tw[0] = 1;
+    for(i = 1; i < n / 2; i++)
+        tw[i] = ntt_mul(tw[i-1], w);
+    for(i = 0; i <= max; i++)
+        a[i] = prime(s, i);
+    ntt(a, tw, n, 0);
+#pragma omp parallel for schedule(static)
+    for(i = 0; i < n; i++)
+        a[i] = ntt_mul(a[i], a[i]);
+    ntt(a, tw, n, 1);
+    for(i = 2; 2 * i <= max; i++)
+        counts[i] = (a[2*i] + prime(s, i)) / 2;
+    free(a);
+    free(tw);
+}
+
+/* Results of verifying a range of even numbers */
+typedef struct
+{
+    long largest, largest_at, violations;
+} Stats;
+
+/* Check every even number in [first,last], keeping the largest smallest partition prime */
+void verify(const Sieve * base, const Sieve * window, long first, long last, Stats * stats)
+{
+    long violations = 0;
+    stats->largest = stats->largest_at = 0;
+#pragma omp parallel reduction(+:violations)
+    {
+        /* Each thread keeps its own maximum, merged once at the end */
+        long i, witness, largest = 0, largest_at = 0;
+#pragma omp for schedule(runtime)
+        for(i = first / 2; i <= last / 2; i++)
+        {
+            witness = gold_witness(base, window, 2*i);
+            if(witness == 0)
+            {
+                fprintf(stdout,"Violated at %ld\n",2*i);
+                violations++;
+            }
+            if(witness > largest)
+            {
+                largest = witness;
+                largest_at = 2*i;
+            }
+        }
+#pragma omp critical
+        if(largest > stats->largest || (largest == stats->largest && largest_at < stats->largest_at))
+        {
+            stats->largest = largest;
+            stats->largest_at = largest_at;
+        }
+    }
+    stats->violations = violations;
+}
+
+/* r(p) for every even p < 2*size, O(p) per number */
+void count_all(const Sieve * s, long size, long * counts)
+{
+    long i;
+#pragma omp parallel for schedule(runtime)
+    for(i = 2; i < size; i++)
+        counts[i] = gold(s, 2*i);
+}
+
+/* Seconds on a clock that is not stepped by NTP */
+double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/* Auto tuning of the OpenMP loop: threads x schedule x chunk */
+typedef struct
+{
+    int threads;
+    omp_sched_t schedule;
+    int chunk;
+} Config;
+
+/* Calibration ranges, long enough to show the scheduling overhead and short enough to sweep */
+#define TUNE_VERIFY (1L << 22)
+#define TUNE_COUNT (1L << 15)
+#define TUNE_REPEATS 5
+#define TUNE_FILE ".goldberg_tune"
+
+/* The best configuration depends on the machine and on which loop runs */
+void tune_key(char * key, size_t n, int count)
+{
+    char host[256] = "unknown", model[256] = "unknown", line[512], * c;
+    FILE * f;
+    gethostname(host, sizeof(host));
+    host[sizeof(host) - 1] = 0;
+    if((f = fopen("/proc/cpuinfo", "r")) != NULL)
+    {
+        while(fgets(line, sizeof(line), f))
+            if(strncmp(line, "model name", 10) == 0 && (c = strchr(line, ':')) != NULL)
+            {
+                snprintf(model, sizeof(model), "%s", c + 2);
+                model[strcspn(model, "\n")] = 0;
+                break;
+            }
+        fclose(f);
+    }
+    snprintf(key, n, "%s|%s|%s", host, model, count ? "count" : "verify");
+}
+
+/* The cache lives in $HOME, one "key<TAB>threads schedule chunk" line per tuning */
+void tune_path(char * path, size_t n)
+{
+    const char * home = getenv("HOME");
+    snprintf(path, n, "%s/%s", home ? home : ".", TUNE_FILE);
+}
+
+/* Returns 1 if the key is cached, the last line for a key wins */
+int tune_load(const char * key, Config * config)
+{
+    char path[1024], line[1024], * tab;
+    int threads, schedule, chunk, found = 0;
+    FILE * f;
+    tune_path(path, sizeof(path));
+    if((f = fopen(path, "r")) == NULL)
+        return 0;
+    while(fgets(line, sizeof(line), f))
+    {
+        if((tab = strchr(line, '\t')) == NULL)
+            continue;
+        *tab = 0;
+        if(strcmp(line, key) == 0 && sscanf(tab + 1, "%d %d %d", &threads, &schedule, &chunk) == 3)
+        {
+            config->threads = threads;
+            config->schedule = (omp_sched_t) schedule;
+            config->chunk = chunk;
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+void tune_save(const char * key, const Config * config)
+{
+    char path[1024];
+    FILE * f;
+    tune_path(path, sizeof(path));
+    if((f = fopen(path, "a")) == NULL)
+    {
+        fprintf(stderr,"Can not write %s\n",path);
+        return;
+    }
+    fprintf(f, "%s\t%d %d %d\n", key, config->threads, (int) config->schedule, config->chunk);
+    fclose(f);
+}
+
+static int compare_double(const void * a, const void * b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Median time of the calibration loop, after one untimed warm up run */
+double tune_time(const Config * config, const Sieve * s, int count, long * counts)
+{
+    double times[TUNE_REPEATS], start;
+    Stats stats;
+    int r;
+    omp_set_num_threads(config->threads);
+    omp_set_schedule(config->schedule, config->chunk);
+    for(r = -1; r < TUNE_REPEATS; r++)
+    {
+        start = now();
+        if(count)
+            count_all(s, TUNE_COUNT / 2 + 1, counts);
+        else
+            verify(s, s, 4, TUNE_VERIFY, &stats);
+        if(r >= 0)
+            times[r] = now() - start;
+    }
+    qsort(times, TUNE_REPEATS, sizeof(double), compare_double);
+    return times[TUNE_REPEATS / 2];
+}
+
+/* Sweep every configuration on the calibration range and cache the fastest */
+void tune(const char * key, int count, Config * best)
+{
+    static const int chunks[] = {0, 1, 16, 256, 4096};
+    int procs = omp_get_num_procs(), threads, schedule, c;
+    double t, best_time = 0;
+    long * counts = NULL;
+    Config config;
+    Sieve sieve;
+    sieve_init(&sieve, 0, count ? TUNE_COUNT : TUNE_VERIFY);
+    if(count)
+        counts = (long *) calloc(TUNE_COUNT / 2 + 1, sizeof(long));
+    printf("threads schedule chunk seconds\n");
+    /* Powers of two and the processor count itself */
+    for(threads = 1; threads <= procs; threads = (threads * 2 > procs && threads < procs) ? procs : threads * 2)
+    {
+        for(schedule = omp_sched_static; schedule <= omp_sched_auto; schedule++)
+            for(c = 0; c < (int) (sizeof(chunks) / sizeof(chunks[0])); c++)
+            {
+                /* auto has no chunk size */
+                if(schedule == omp_sched_auto && c > 0)
+                    break;
+                config.threads = threads;
+                config.schedule = (omp_sched_t) schedule;
+                config.chunk = chunks[c];
+                t = tune_time(&config, &sieve, count, counts);
+                printf("%7d %8d %5d %.9f\n", threads, schedule, chunks[c], t);
+                if(best_time == 0 || t < best_time)
+                {
+                    best_time = t;
+                    *best = config;
+                }
+            }
+        if(threads == procs)
+            break;
+    }
+    printf("Tuned: -n %d -s %d -m %d\n", best->threads, (int) best->schedule, best->chunk);
+    tune_save(key, best);
+    free(counts);
+    free(sieve.bits);
+}
+
+#ifdef USE_MPI
+/* MPI+OpenMP verification.
+   Each rank checks one block of the even numbers, using a base sieve of the small primes
+   and a window sieve of [first - WITNESS_BOUND, last] for the larger partner p-q.
+   Only the statistics are communicated. */
+void verify_distributed(long max)
+{
+    int rank, size, i;
+    long first, last, bound = (long) sqrt((double) max) + 1;
+    long local[3], * all;
+    double start, end;
+    Sieve base, window;
+    Stats stats;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    start = MPI_Wtime();
+    first = 4 + 2 * ((max / 2 - 1) * rank / size);
+    last = 2 + 2 * ((max / 2 - 1) * (rank + 1) / size);
+    sieve_init(&base, 0, (bound > WITNESS_BOUND) ? bound : WITNESS_BOUND);
+    sieve_init(&window, first - WITNESS_BOUND, last);
+    verify(&base, &window, first, last, &stats);
+    local[0] = stats.largest;
+    local[1] = stats.largest_at;
+    local[2] = stats.violations;
+    all = (long *) malloc(sizeof(long) * 3 * size);
+    MPI_Gather(local, 3, MPI_LONG, all, 3, MPI_LONG, 0, MPI_COMM_WORLD);
+    end = MPI_Wtime();
+    if(rank == 0)
+    {
+        for(i = 1; i < size; i++)
+        {
+            if(all[3*i] > local[0])
+            {
+                local[0] = all[3*i];
+                local[1] = all[3*i+1];
+            }
+            local[2] += all[3*i+2];
+        }
+        printf("Ranks: %d\tViolations: %ld\n",size,local[2]);
+        printf("Largest smallest partition prime: %ld (for %ld)\n",local[0],local[1]);
+        printf("%f\n",end-start);
+    }
+    free(all);
+    free(base.bits);
+    free(window.bits);
+}
+#endif
+
 void usage()
 {
     printf("Usage: goldberg [ARGS]\n\
@@ -50,32 +548,75 @@ void usage()
 	    \t\t\tAuto\t4\n\
 	    -m <int>\t\tSchedule modifier\n\
 	    \t\t\tFor Dynamic,guided & static this is the chunk size\n\
-	    -h\t\t\tPrint this message\n");
+	    -u <int>\t\tLargest even number to check (default %d)\n\
+	    -c\t\t\tCount every partition instead of finding one\n\
+	    -f\t\t\tCount every partition with one transform of the primes\n\
+	    -p\t\t\tPrint the counts (with -c or -f)\n\
+	    -a\t\t\tTune -n, -s and -m on a calibration range and cache the result\n\
+	    \t\t\tin ~/%s; without -n, -s or -m the cached values are used\n\
+	    -d\t\t\tSplit the range over MPI ranks (goldberg_mpi)\n\
+	    -h\t\t\tPrint this message\n", MAX, TUNE_FILE);
 }
 int main(int argc, char*argv[])
 {
-    int max = MAX;
-    int min = MIN;
-    int size = (max-min)/2;
-    int * array = (int*) malloc(sizeof(int)*size);
-    int i;
-    struct timespec start, end,elapsed;
+    long max = MAX;
+    long min = MIN;
+    long size;
+    long * array = NULL;
+    long i;
+    double start;
     int c = 0;
     int num_threads = 1;
     int modifier = 0;
+    int count = 0;
+    int distributed = 0;
+    int transform = 0;
+    int print = 0;
+    int autotune = 0;
+    int manual = 0;
+    char key[1024];
+    Config config;
+    Stats stats;
+    Sieve sieve;
     omp_sched_t schedule = 1;
-    while((c = getopt(argc,argv,"n:s:m:h")) != -1)
+#ifdef USE_MPI
+    int provided;
+    /* MPI is only called outside the OpenMP regions, from the master thread */
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#endif
+    while((c = getopt(argc,argv,"n:s:m:u:cfpadh")) != -1)
     {
         switch(c)
         {
             case 'n':
                 num_threads = atoi(optarg);
+                manual = 1;
                 break;
 	    case 's':
 		schedule = atoi(optarg);
+		manual = 1;
 		break;
 	    case 'm':
 		modifier = atoi(optarg);
+		manual = 1;
+		break;
+	    case 'u':
+		max = atol(optarg);
+		break;
+	    case 'c':
+		count = 1;
+		break;
+	    case 'f':
+		transform = 1;
+		break;
+	    case 'p':
+		print = 1;
+		break;
+	    case 'a':
+		autotune = 1;
+		break;
+	    case 'd':
+		distributed = 1;
 		break;
 	    case 'h':
 		usage();
@@ -84,26 +625,74 @@ int main(int argc, char*argv[])
                 break;
         }
     }
+    size = max/2 + 1;
+    tune_key(key, sizeof(key), count);
+#ifdef USE_MPI
+    /* Ranks sharing a node would time each other */
+    if(autotune && distributed)
+    {
+        fprintf(stderr,"-a is ignored with -d, tune with a single process first\n");
+        autotune = 0;
+    }
+#endif
+    if(autotune)
+        tune(key, count, &config);
+    if(autotune || (!manual && tune_load(key, &config)))
+    {
+        num_threads = config.threads;
+        schedule = config.schedule;
+        modifier = config.chunk;
+    }
+#ifdef USE_MPI
+    if(provided < MPI_THREAD_FUNNELED && num_threads > 1)
+    {
+        fprintf(stderr,"MPI library lacks MPI_THREAD_FUNNELED, using one thread\n");
+        num_threads = 1;
+    }
+#endif
     omp_set_num_threads(num_threads);
     omp_set_schedule(schedule,modifier);
-    clock_gettime(CLOCK_REALTIME, &start);
-    for(i = 1; i < size; i++)
-	array[i] = 0;
-#pragma omp parallel for
-    for(i = 1; i < size; i++)
-	array[i] = gold(2*i);
-#pragma omp parallel for
-    for(i = 1; i < size; i++)
-	if(array[i] == 0)
-	    fprintf(stdout,"Violated at %d\n",2*i);
-    clock_gettime(CLOCK_REALTIME, &end);
-    elapsed.tv_sec = end.tv_sec - start.tv_sec;
-    elapsed.tv_nsec = end.tv_nsec - start.tv_nsec;
-    if(elapsed.tv_nsec < 0)
-    {
-	elapsed.tv_sec -= 1;
-	elapsed.tv_nsec += 1000000000;
-    }
-    printf("%ld.%ld\n",elapsed.tv_sec,elapsed.tv_nsec);
+    start = now();
+#ifdef USE_MPI
+    if(distributed)
+    {
+        verify_distributed(max);
+        MPI_Finalize();
+        return 0;
+    }
+#else
+    if(distributed)
+        fprintf(stderr,"Built without MPI, checking the whole range here (make goldberg_mpi)\n");
+#endif
+    sieve_init(&sieve, 0, max);
+    /* Counting every partition is O(p) per number, keep the counts */
+    if(count || transform)
+    {
+        array = (long*) calloc(size, sizeof(long));
+        /* O(max log max) for the whole range */
+        if(transform)
+            gold_all(&sieve, max, array);
+        else
+            count_all(&sieve, size, array);
+        for(i = 2; i < size; i++)
+        {
+            if(print)
+                fprintf(stdout,"%ld %ld\n",2*i,array[i]);
+            if(array[i] == 0 && 2*i > min)
+                fprintf(stdout,"Violated at %ld\n",2*i);
+        }
+    }
+    /* Verifying only needs the smallest partition, which is found after a few primes */
+    else
+    {
+        verify(&sieve, &sieve, 4, max, &stats);
+        printf("Largest smallest partition prime: %ld (for %ld)\n",stats.largest,stats.largest_at);
+    }
+    printf("%.9f\n",now() - start);
+    free(array);
+    free(sieve.bits);
+#ifdef USE_MPI
+    MPI_Finalize();
+#endif
     return 0;
 }
@@ -6,10 +6,14 @@
 
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
 #include<string.h>
 #include<unistd.h>
 #include<mpi.h>
 #include<math.h>
+#ifdef __AVX__
+#include<immintrin.h>
+#endif
 
 /* Integration Interval */
 #define INTERVAL_MIN 0.0
@@ -18,87 +22,667 @@
 #define NUM_INTERVALS 1
 /* Default Error Threshold */
 #define ERROR_THRESHOLD 0.00001
+/* Abscissae evaluated per call of the batch integrand */
+#define BATCH_SIZE 256
+/* Panels a slave integrates from the work pool before handing leftover subintervals back */
+#define POOL_BATCH 64
+
+/* Pieces a slave splits its region into while speculating, cancellation is checked between them */
+#define PIPELINE_CHUNKS 64
+/* Seed of the counter based random number generator */
+#define MC_SEED 0x5DEECE66DULL
+/* Randomly shifted Sobol replicates used for the quasi-Monte Carlo error estimate */
+#define SOBOL_SHIFTS 8
+/* Dimensions supported by the Sobol direction numbers below */
+#define SOBOL_MAX_DIMS 16
+
+typedef enum { DATA_TAG, TERM_TAG, RESULT_TAG } Tags;
 
 /* Struct to hold configuration options */
 typedef struct
 {
-    int intervals,rank,size;
+    long intervals;
+    int rank,size;
     double delta,region;
     double error;
     double min,max;
     double (*func)(double start, double end, double delta);
+    double (*adaptive)(double start, double end, double tol);
+    /* Incremental (Romberg) refinement: panels and trapezoid sum of the previous round */
+    int romberg;
+    long panels;
+    double sum;
+    /* Distribute adaptive refinement through a work pool on the master */
+    int pool;
+    /* Monte Carlo over [min,max]^dims, quasi-Monte Carlo if sobol is set */
+    int dims, sobol;
+    long samples;
+    /* Overlap refinement rounds with non-blocking collectives */
+    int pipeline;
 } Params;
 
+/* Number of evaluations of f(x) done by this rank */
+long evaluations = 0;
+
+/* The integrand, the only definition of it shared by f() and f_batch() */
+static inline double f_value(double x)
+{
+    return sqrt(1-x*x);
+}
+
 /* Function f(x) to be integrated */
 double f(double x)
 {
-    return sqrt(1-x*x); 
+    evaluations++;
+    return f_value(x);
+}
+
+/* Batch form of f(x): y[i] = f(x[i]) for n abscissae.
+   The AVX lane is the one special case, a vector copy of f_value() that has to be changed
+   along with it.  It is only compiled in when building with -mavx (or -march=native). */
+void f_batch(const double * x, double * y, int n)
+{
+    int i = 0;
+    evaluations += n;
+#ifdef __AVX__
+    __m256d one = _mm256_set1_pd(1.0), v;
+    for(; i + 4 <= n; i += 4)
+    {
+        v = _mm256_loadu_pd(&x[i]);
+        _mm256_storeu_pd(&y[i], _mm256_sqrt_pd(_mm256_sub_pd(one, _mm256_mul_pd(v, v))));
+    }
+#endif
+    for(; i < n; i++)
+        y[i] = f_value(x[i]);
+}
+
+/* Pairwise summation, the rounding error grows with log(n) instead of n */
+double pairwise_sum(const double * y, int n)
+{
+    double sum = 0.0;
+    int i;
+    if(n <= 16)
+    {
+        for(i = 0; i < n; i++)
+            sum += y[i];
+        return sum;
+    }
+    return pairwise_sum(y, n/2) + pairwise_sum(&y[n/2], n - n/2);
+}
+
+/* Sum of f(start + i*delta) for first <= i < first+count.
+   Abscissae are computed from the index so they do not drift, each batch is summed pairwise
+   and the batch sums are accumulated with Kahan compensation. */
+double batch_sum(double start, double delta, long first, long count)
+{
+    double x[BATCH_SIZE], y[BATCH_SIZE];
+    double sum = 0.0, c = 0.0, term, t;
+    long i;
+    int j, n;
+    for(i = first; i < first + count; i += n)
+    {
+        n = (first + count - i < BATCH_SIZE) ? first + count - i : BATCH_SIZE;
+        for(j = 0; j < n; j++)
+            x[j] = start + (i + j) * delta;
+        f_batch(x, y, n);
+        term = pairwise_sum(y, n) - c;
+        t = sum + term;
+        c = (t - sum) - term;
+        sum = t;
+    }
+    return sum;
+}
+
+/* Number of steps of size delta in [start,end] */
+long num_steps(double start, double end, double delta)
+{
+    long n = (long) floor((end - start) / delta + 0.5);
+    return (n < 1) ? 1 : n;
 }
 
 /* Approximation of f(x) using the rectangle rule */
 double rectangle_rule(double start, double end, double delta)
 {
-    double area = 0.0;
-    double x;
-    for(x = start; x <= end; x+= delta)
-        area += f(x)*delta;
-    return area;
+    return batch_sum(start, delta, 0, num_steps(start, end, delta)) * delta;
 }
 
 /* Approximation of f(x) using the trapezoid rule */
 double trapezoid_rule(double start, double end, double delta)
 {
-        double area = 0.0;
-        area = 0.5 * ( f(start) + f(end) );
-        double x  = 0.0;
-        for(x = start + delta; x <= end; x+= delta)
-        {
-            area += f(x);
-        }
+        long n = num_steps(start, end, delta);
+        double area = 0.5 * ( f(start) + f(end) );
+        area += batch_sum(start, delta, 1, n - 1);
         area = area * delta;
         return area;
 }
 
+/* Gauss-Kronrod 7-15 nodes (positive half) and weights */
+static const double gk_nodes[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.000000000000000000000000000000000 };
+static const double kronrod_weights[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714 };
+/* Gauss weights for the odd numbered Kronrod nodes */
+static const double gauss_weights[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327 };
+
+/* One Gauss-Kronrod 7-15 panel on [a,b], the error estimate is |K15 - G7| */
+double gk15(double a, double b, double * err)
+{
+    double center = 0.5 * (a + b), half = 0.5 * (b - a);
+    double fc = f(center), f1, f2;
+    double kronrod = fc * kronrod_weights[7], gauss = fc * gauss_weights[3];
+    int i;
+    for(i = 0; i < 7; i++)
+    {
+        f1 = f(center - half * gk_nodes[i]);
+        f2 = f(center + half * gk_nodes[i]);
+        kronrod += kronrod_weights[i] * (f1 + f2);
+        if(i % 2 == 1)
+            gauss += gauss_weights[i/2] * (f1 + f2);
+    }
+    *err = fabs((kronrod - gauss) * half);
+    return kronrod * half;
+}
+
+/* Accept a panel if it is accurate enough or too small to split further.
+   A panel may use the share of tol proportional to its length. */
+int gk_accept(double a, double b, double err, double tol, double length)
+{
+    return err <= tol * (b - a) / length || b - a < 1e-12 * length;
+}
+
+/* Adaptive Gauss-Kronrod quadrature.
+   Subintervals are bisected only while their error estimate is above their share of tol. */
+double gauss_kronrod(double start, double end, double tol)
+{
+    /* Explicit stack of subintervals still to be integrated */
+    int depth = 0, max_depth = 128;
+    double * stack = (double *) malloc(sizeof(double) * 2 * max_depth);
+    double area = 0.0, a, b, err, result;
+    stack[depth++] = start;
+    stack[depth++] = end;
+    while(depth > 0)
+    {
+        b = stack[--depth];
+        a = stack[--depth];
+        result = gk15(a, b, &err);
+        if(gk_accept(a, b, err, tol, end - start) || depth + 4 > 2 * max_depth)
+            area += result;
+        else
+        {
+            stack[depth++] = a;
+            stack[depth++] = 0.5 * (a + b);
+            stack[depth++] = 0.5 * (a + b);
+            stack[depth++] = b;
+        }
+    }
+    free(stack);
+    return area;
+}
+
+/* Recursive step of adaptive Simpson, reusing the three known function values */
+double simpson_step(double a, double b, double fa, double fm, double fb, double whole, double tol, int depth)
+{
+    double m = 0.5 * (a + b), lm = 0.5 * (a + m), rm = 0.5 * (m + b);
+    double flm = f(lm), frm = f(rm);
+    double left = (m - a) / 6.0 * (fa + 4.0 * flm + fm);
+    double right = (b - m) / 6.0 * (fm + 4.0 * frm + fb);
+    double delta = left + right - whole;
+    if(depth <= 0 || fabs(delta) <= 15.0 * tol)
+        return left + right + delta / 15.0;
+    return simpson_step(a, m, fa, flm, fm, left, 0.5 * tol, depth - 1)
+         + simpson_step(m, b, fm, frm, fb, right, 0.5 * tol, depth - 1);
+}
+
+/* Adaptive Simpson quadrature */
+double adaptive_simpson(double start, double end, double tol)
+{
+    double fa = f(start), fb = f(end), fm = f(0.5 * (start + end));
+    double whole = (end - start) / 6.0 * (fa + 4.0 * fm + fb);
+    return simpson_step(start, end, fa, fm, fb, whole, tol, 50);
+}
+
+/* Trapezoid sum of [start,end] with the given number of panels.
+   When the panel count doubled since the last call only the new midpoints are evaluated
+   and combined with the previous sum, T(h/2) = T(h)/2 + h/2 * sum f(midpoints). */
+double incremental_trapezoid(Params * p, double start, double end, long panels)
+{
+    double h = (end - start) / panels;
+    if(p->panels == 0 || panels != 2 * p->panels)
+        p->sum = (0.5 * (f(start) + f(end)) + batch_sum(start, h, 1, panels - 1)) * h;
+    else
+        p->sum = 0.5 * p->sum + h * batch_sum(start + h, 2 * h, 0, p->panels);
+    p->panels = panels;
+    return p->sum;
+}
+
+/* Master side of the distributed adaptive integration.
+   The master keeps a pool of subintervals that still need work. Slaves take one, refine it
+   for at most POOL_BATCH panels and return the accepted area together with every subinterval
+   they did not finish, so refinement around a singularity spreads over all ranks. */
+void pool_master(Params * p)
+{
+    int capacity = 8 * p->size, count = 0, num_idle = 0, n, i;
+    double * pool = (double *) malloc(sizeof(double) * 2 * capacity);
+    double * buffer = (double *) malloc(sizeof(double) * (2 * POOL_BATCH + 3));
+    int * idle = (int *) malloc(sizeof(int) * p->size);
+    double area = 0.0, start, end;
+    long evals = 0;
+    MPI_Status status;
+
+    start = MPI_Wtime();
+    /* Seed the pool with a few pieces per slave */
+    for(count = 0; count < 4 * p->size; count++)
+    {
+        pool[2*count] = p->min + (p->max - p->min) * count / (4 * p->size);
+        pool[2*count+1] = p->min + (p->max - p->min) * (count + 1) / (4 * p->size);
+    }
+    /* Done when every slave is waiting and the pool is empty */
+    while(num_idle < p->size)
+    {
+        MPI_Recv(buffer, 2 * POOL_BATCH + 3, MPI_DOUBLE, MPI_ANY_SOURCE, RESULT_TAG, MPI_COMM_WORLD, &status);
+        MPI_Get_count(&status, MPI_DOUBLE, &n);
+        area += buffer[0];
+        for(i = 1; i + 1 < n; i += 2)
+        {
+            if(count == capacity)
+            {
+                capacity *= 2;
+                pool = (double *) realloc(pool, sizeof(double) * 2 * capacity);
+            }
+            pool[2*count] = buffer[i];
+            pool[2*count+1] = buffer[i+1];
+            count++;
+        }
+        idle[num_idle++] = status.MPI_SOURCE;
+        while(num_idle > 0 && count > 0)
+        {
+            count--;
+            MPI_Send(&pool[2*count], 2, MPI_DOUBLE, idle[--num_idle], DATA_TAG, MPI_COMM_WORLD);
+        }
+    }
+    for(i = 0; i < num_idle; i++)
+        MPI_Send(buffer, 2, MPI_DOUBLE, idle[i], TERM_TAG, MPI_COMM_WORLD);
+    MPI_Reduce(&evaluations,&evals,1,MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    end = MPI_Wtime();
+    fprintf(stderr,"Work pool\tResult = %f\tEvaluations = %ld\tTime = %f\n",area,evals,end-start);
+    free(pool);
+    free(buffer);
+    free(idle);
+}
+
+/* Slave side of the distributed adaptive integration */
+void pool_slave(Params * p)
+{
+    /* buffer[0] is the accepted area, followed by the unfinished subintervals */
+    double * buffer = (double *) malloc(sizeof(double) * (2 * POOL_BATCH + 3));
+    double * stack = &buffer[1];
+    double task[2], a, b, err, result;
+    int depth = 0, panels;
+    MPI_Status status;
+
+    /* An empty result asks for the first piece of work */
+    buffer[0] = 0.0;
+    MPI_Send(buffer, 1, MPI_DOUBLE, 0, RESULT_TAG, MPI_COMM_WORLD);
+    while(1)
+    {
+        MPI_Recv(task, 2, MPI_DOUBLE, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        if(status.MPI_TAG == TERM_TAG)
+            break;
+        buffer[0] = 0.0;
+        depth = 0;
+        stack[depth++] = task[0];
+        stack[depth++] = task[1];
+        for(panels = 0; depth > 0 && panels < POOL_BATCH; panels++)
+        {
+            b = stack[--depth];
+            a = stack[--depth];
+            result = gk15(a, b, &err);
+            if(gk_accept(a, b, err, p->error, p->max - p->min))
+                buffer[0] += result;
+            else
+            {
+                stack[depth++] = a;
+                stack[depth++] = 0.5 * (a + b);
+                stack[depth++] = 0.5 * (a + b);
+                stack[depth++] = b;
+            }
+        }
+        MPI_Send(buffer, depth + 1, MPI_DOUBLE, 0, RESULT_TAG, MPI_COMM_WORLD);
+    }
+    MPI_Reduce(&evaluations,NULL,1,MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    free(buffer);
+}
+
+/* f(x) generalized to d dimensions: sqrt(1-|x|^2) inside the unit ball, 0 outside */
+double f_multi(const double * x, int d)
+{
+    double r = 0.0;
+    int i;
+    evaluations++;
+    for(i = 0; i < d; i++)
+        r += x[i]*x[i];
+    return (r < 1.0) ? sqrt(1-r) : 0.0;
+}
+
+/* Counter based random numbers (SplitMix64 finalizer).
+   The value depends only on (seed, counter), so any rank can generate any sample directly
+   and the result does not depend on the number of ranks. */
+uint64_t mix64(uint64_t seed, uint64_t counter)
+{
+    uint64_t z = seed + (counter + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Uniform double in [0,1) */
+double uniform(uint64_t seed, uint64_t counter)
+{
+    return (mix64(seed, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Sobol direction numbers (Joe and Kuo): degree s, polynomial a and initial m_1..m_s
+   for dimensions 2 and up, dimension 1 is the van der Corput sequence */
+static const struct { int s, a, m[6]; } sobol_table[SOBOL_MAX_DIMS-1] = {
+    {1, 0, {1}}, {2, 1, {1,3}}, {3, 1, {1,3,1}}, {3, 2, {1,1,1}},
+    {4, 1, {1,1,3,3}}, {4, 4, {1,3,5,13}}, {5, 2, {1,1,5,5,17}},
+    {5, 4, {1,1,5,5,5}}, {5, 7, {1,1,7,11,19}}, {5, 11, {1,1,5,1,1}},
+    {5, 13, {1,1,1,3,11}}, {5, 14, {1,3,5,5,31}}, {6, 1, {1,3,3,9,7,49}},
+    {6, 13, {1,1,1,15,21,21}}, {6, 16, {1,3,1,13,27,49}} };
+
+/* Fill v[d*32+k] with the 32 bit direction numbers of every dimension */
+void sobol_directions(uint32_t * v, int dims)
+{
+    int d, k, i, s, a;
+    for(k = 0; k < 32; k++)
+        v[k] = 1u << (31 - k);
+    for(d = 1; d < dims; d++)
+    {
+        s = sobol_table[d-1].s;
+        a = sobol_table[d-1].a;
+        for(k = 0; k < s && k < 32; k++)
+            v[d*32+k] = (uint32_t) sobol_table[d-1].m[k] << (31 - k);
+        for(k = s; k < 32; k++)
+        {
+            v[d*32+k] = v[d*32+k-s] ^ (v[d*32+k-s] >> s);
+            for(i = 1; i < s; i++)
+                if((a >> (s - 1 - i)) & 1)
+                    v[d*32+k] ^= v[d*32+k-i];
+        }
+    }
+}
+
+/* d-dimensional Monte Carlo or quasi-Monte Carlo integration over [min,max]^dims.
+   Each slave takes a contiguous block of the global sample indices. Plain Monte Carlo
+   reduces the sum and the sum of squares for a standard error; Sobol points are evaluated
+   under SOBOL_SHIFTS random digital shifts and the spread of the replicates gives the error. */
+void multi_integrate(Params * p)
+{
+    int d = p->dims, r, k, nsums = p->sobol ? SOBOL_SHIFTS : 2;
+    double * x = (double *) malloc(sizeof(double) * d);
+    double sums[SOBOL_SHIFTS], totals[SOBOL_SHIFTS], value, mean, var, width = p->max - p->min;
+    double volume = pow(width, d), start = MPI_Wtime();
+    long first = 0, last = 0, i, evals = 0;
+    uint32_t * v = NULL, * point = NULL, * shift = NULL;
+
+    memset(sums, 0, sizeof(sums));
+    /* The master only collects */
+    if(p->rank != 0)
+    {
+        first = p->samples * (p->rank - 1) / p->size;
+        last = p->samples * p->rank / p->size;
+    }
+    if(p->sobol && first < last)
+    {
+        v = (uint32_t *) malloc(sizeof(uint32_t) * 32 * d);
+        point = (uint32_t *) calloc(d, sizeof(uint32_t));
+        shift = (uint32_t *) malloc(sizeof(uint32_t) * SOBOL_SHIFTS * d);
+        sobol_directions(v, d);
+        for(k = 0; k < SOBOL_SHIFTS * d; k++)
+            shift[k] = (uint32_t) mix64(MC_SEED, k);
+        /* Jump to point 'first' through its Gray code, index 0 (the origin) is skipped */
+        for(k = 0; k < 32; k++)
+            if((((first + 1) ^ ((first + 1) >> 1)) >> k) & 1)
+                for(r = 0; r < d; r++)
+                    point[r] ^= v[r*32+k];
+    }
+    for(i = first; i < last; i++)
+    {
+        if(p->sobol)
+        {
+            for(r = 0; r < SOBOL_SHIFTS; r++)
+            {
+                for(k = 0; k < d; k++)
+                    x[k] = p->min + width * ((point[k] ^ shift[r*d+k]) * (1.0 / 4294967296.0));
+                sums[r] += f_multi(x, d);
+            }
+            /* Next point in Gray code order: flip the direction of the lowest zero bit */
+            for(k = 0; ((i + 1) >> k) & 1; k++);
+            for(r = 0; r < d; r++)
+                point[r] ^= v[r*32+k];
+        }
+        else
+        {
+            for(k = 0; k < d; k++)
+                x[k] = p->min + width * uniform(MC_SEED, i * d + k);
+            value = f_multi(x, d);
+            sums[0] += value;
+            sums[1] += value * value;
+        }
+    }
+    MPI_Reduce(sums, totals, nsums, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&evaluations, &evals, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(p->rank == 0)
+    {
+        if(p->sobol)
+        {
+            for(r = 0, mean = 0.0; r < SOBOL_SHIFTS; r++)
+                mean += totals[r] / p->samples / SOBOL_SHIFTS;
+            for(r = 0, var = 0.0; r < SOBOL_SHIFTS; r++)
+                var += pow(totals[r] / p->samples - mean, 2.0) / (SOBOL_SHIFTS - 1);
+            var /= SOBOL_SHIFTS;
+        }
+        else
+        {
+            mean = totals[0] / p->samples;
+            var = (totals[1] / p->samples - mean * mean) / (p->samples - 1);
+        }
+        fprintf(stderr,"%s d = %d\tSamples = %ld\tResult = %f\tError = %g\tEvaluations = %ld\tTime = %f\n",
+                p->sobol ? "Sobol" : "Monte Carlo", d, p->samples, mean * volume, sqrt(var) * volume, evals, MPI_Wtime() - start);
+    }
+    free(x);
+    free(v);
+    free(point);
+    free(shift);
+}
+
 /* Function to be executed by the master rank */
 void master(Params * p)
 {   
     double last = 0.0;
-    double area = p->error+1,local;
+    double area = p->error+1,local = 0.0;
     double start, end;
+    long evals = 0;
+    if(p->dims > 0)
+    {
+        multi_integrate(p);
+        return;
+    }
+    if(p->pool)
+    {
+        pool_master(p);
+        return;
+    }
+    /* Adaptive quadrature refines where it is needed, so a single round is enough */
+    if(p->adaptive)
+    {
+        start = MPI_Wtime();
+        MPI_Bcast(&p->intervals,1,MPI_LONG,0,MPI_COMM_WORLD);
+        MPI_Reduce(&local,&area,1,MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&evaluations,&evals,1,MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        end = MPI_Wtime();
+        fprintf(stderr,"Adaptive\tResult = %f\tEvaluations = %ld\tTime = %f\n",area,evals,end-start);
+        p->intervals = -1;
+        MPI_Bcast(&p->intervals,1,MPI_LONG,0,MPI_COMM_WORLD);
+        return;
+    }
+    /* Romberg table rows, row k holds the extrapolations of the trapezoid sum at level k */
+    double prev[32], row[32], factor;
+    int level = 0, j;
+    /* Incremental refinement starts with one panel per slave */
+    if(p->romberg)
+        p->intervals = p->size;
+    /* Pipelined mode: slaves follow the doubling on their own, the master only sends a decision */
+    double sums[2] = {0.0, 0.0}, results[2];
+    long next;
+    MPI_Request request;
     /* Loop until the difference of results is less than the error */
     while(fabs(last - area) > p->error)
     {
         last = area;
         /* Start the clock */
         start = MPI_Wtime();
-        /* Broadcast the intervals */
-        MPI_Bcast(&p->intervals,1,MPI_INT,0,MPI_COMM_WORLD);
-        /* Reduce the result */
-        MPI_Reduce(&local,&area,1,MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        if(p->pipeline)
+        {
+            /* Result and evaluation count of this level, slaves are already on the next one */
+            MPI_Ireduce(sums,results,2,MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &request);
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+            area = results[0];
+            evals = (long) results[1];
+        }
+        else
+        {
+            /* Broadcast the intervals */
+            MPI_Bcast(&p->intervals,1,MPI_LONG,0,MPI_COMM_WORLD);
+            /* Reduce the result */
+            MPI_Reduce(&local,&area,1,MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            MPI_Reduce(&evaluations,&evals,1,MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        }
+        /* Richardson extrapolation of the trapezoid sums */
+        if(p->romberg && level < 32)
+        {
+            row[0] = area;
+            for(j = 1, factor = 4.0; j <= level; j++, factor *= 4.0)
+                row[j] = row[j-1] + (row[j-1] - prev[j-1]) / (factor - 1.0);
+            memcpy(prev, row, sizeof(double) * (level + 1));
+            area = row[level++];
+        }
         /* Stop the clock */
         end = MPI_Wtime();
         /* Calculate delta */
         p->delta = (p->max-p->min)/p->intervals;
         /* Print results */
-        fprintf(stderr,"Intervals = %8d\tDelta = %f\tResult = %f\tError=%f\tTime = %f\n",p->intervals,p->delta,area,fabs(last-area),end-start);
+        fprintf(stderr,"Intervals = %8ld\tDelta = %f\tResult = %f\tError=%f\tEvaluations = %ld\tTime = %f\n",p->intervals,p->delta,area,fabs(last-area),evals,end-start);
         /* Double the number of intervals */
         p->intervals = p->intervals*2;
+        /* Tell the slaves whether the level they are speculating on is needed */
+        if(p->pipeline)
+        {
+            next = (fabs(last - area) > p->error) ? p->intervals : -1;
+            MPI_Ibcast(&next,1,MPI_LONG,0,MPI_COMM_WORLD,&request);
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+        }
     } 
     /* Send all ranks term signal */
+    if(p->pipeline)
+        return;
     p->intervals = -1;
-    MPI_Bcast(&p->intervals,1,MPI_INT,0,MPI_COMM_WORLD);
+    MPI_Bcast(&p->intervals,1,MPI_LONG,0,MPI_COMM_WORLD);
     return;
 }
 
+/* Evaluate the rule on [start,end] in pieces aligned to delta, giving up as soon as the
+   master's decision arrives and says this level is not needed. Returns 0 if cancelled. */
+int speculative_rule(Params * p, double start, double end, double * area, MPI_Request * decision, long * next)
+{
+    long n = num_steps(start, end, p->delta), c;
+    long chunks = (n < PIPELINE_CHUNKS) ? n : PIPELINE_CHUNKS;
+    int flag;
+    *area = 0.0;
+    if(p->romberg)
+    {
+        *area = incremental_trapezoid(p,start,end,p->intervals/p->size);
+        return 1;
+    }
+    for(c = 0; c < chunks; c++)
+    {
+        if(*decision != MPI_REQUEST_NULL)
+        {
+            MPI_Test(decision, &flag, MPI_STATUS_IGNORE);
+            if(flag && *next == -1)
+                return 0;
+        }
+        *area += p->func(start + (n * c / chunks) * p->delta,
+                         (c == chunks - 1) ? end : start + (n * (c + 1) / chunks) * p->delta, p->delta);
+    }
+    return 1;
+}
+
+/* Slave side of the pipelined refinement.
+   After returning level k with MPI_Ireduce the slave starts level k+1 right away, while the
+   master decides whether k converged. The decision comes with MPI_Ibcast and stops the
+   speculative work early if it is not needed. */
+void pipelined_slave(Params * p)
+{
+    double start, end, area, sums[2];
+    long next = 0;
+    MPI_Request reduction = MPI_REQUEST_NULL, decision = MPI_REQUEST_NULL;
+    if(p->romberg)
+        p->intervals = p->size;
+    p->region = (p->max-p->min)/(double)p->size;
+    start = p->min + p->region * (p->rank-1);
+    end = start + p->region;
+    while(1)
+    {
+        p->delta = (p->max-p->min)/p->intervals;
+        if(!speculative_rule(p, start, end, &area, &decision, &next))
+            break;
+        /* Collectives must be posted in the master's order, so the previous decision comes first */
+        MPI_Wait(&decision, MPI_STATUS_IGNORE);
+        if(next == -1)
+            break;
+        MPI_Wait(&reduction, MPI_STATUS_IGNORE);
+        sums[0] = area;
+        sums[1] = (double) evaluations;
+        MPI_Ireduce(sums,NULL,2,MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &reduction);
+        MPI_Ibcast(&next,1,MPI_LONG,0,MPI_COMM_WORLD,&decision);
+        p->intervals = p->intervals*2;
+    }
+    MPI_Wait(&reduction, MPI_STATUS_IGNORE);
+}
+
 /* Function to be executed by all the slaves */
 void slave(Params *p)
 {
     double start, end, area;
+    if(p->dims > 0)
+    {
+        multi_integrate(p);
+        return;
+    }
+    if(p->pool)
+    {
+        pool_slave(p);
+        return;
+    }
+    if(p->pipeline && !p->adaptive)
+    {
+        pipelined_slave(p);
+        return;
+    }
     /* Loop until done */
     while(1)
     {
         /* Receive the interval count */
-        MPI_Bcast(&p->intervals,1,MPI_INT,0,MPI_COMM_WORLD);
+        MPI_Bcast(&p->intervals,1,MPI_LONG,0,MPI_COMM_WORLD);
         /* Terminate if no more work to do */
         if(p->intervals == -1)
             return;
@@ -110,10 +694,16 @@ void slave(Params *p)
         end = start + p->region;
         /* Calculate step (delta) */
         p->delta = (p->max-p->min)/p->intervals;
-        /* Use either the trapezoid or rectangle rule */
-        area = p->func(start,end,p->delta);
+        /* Use adaptive quadrature with this rank's share of the error, or the trapezoid or rectangle rule */
+        if(p->adaptive)
+            area = p->adaptive(start,end,p->error/p->size);
+        else if(p->romberg)
+            area = incremental_trapezoid(p,start,end,p->intervals/p->size);
+        else
+            area = p->func(start,end,p->delta);
         /* Return results */
-        MPI_Reduce(&area,&area,1,MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&area,NULL,1,MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&evaluations,NULL,1,MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
         }
 }
 
@@ -128,6 +718,14 @@ void usage()
             e <error>\t\tMaximum error threshold\n\
             t\t\tUse the trapezoid rule\n\
             r\t\tUse the rectangle rule\n\
+            k\t\tUse adaptive Gauss-Kronrod 7-15 quadrature\n\
+            s\t\tUse adaptive Simpson quadrature\n\
+            i\t\tUse incremental trapezoid refinement with Romberg extrapolation\n\
+            q\t\tUse adaptive Gauss-Kronrod with a load balanced work pool\n\
+            d <dims>\t\tMonte Carlo integration over [a,b]^dims\n\
+            n <samples>\t\tNumber of Monte Carlo samples\n\
+            l\t\tUse Sobol low discrepancy points for Monte Carlo\n\
+            p\t\tPipeline refinement rounds with non-blocking collectives\n\
             h\t\tPrint this message\n");
 }
 
@@ -135,7 +733,7 @@ void usage()
 void parse_args(int argc, char ** argv, Params * p)
 {
     int c = 0;
-    while((c = getopt(argc,argv,"a:b:e:trh")) != -1)
+    while((c = getopt(argc,argv,"a:b:e:trksiqd:n:lph")) != -1)
     {
         switch(c)
         {
@@ -154,6 +752,30 @@ void parse_args(int argc, char ** argv, Params * p)
             case 'r':
                 p->func = rectangle_rule;
                 break;
+            case 'k':
+                p->adaptive = gauss_kronrod;
+                break;
+            case 's':
+                p->adaptive = adaptive_simpson;
+                break;
+            case 'i':
+                p->romberg = 1;
+                break;
+            case 'q':
+                p->pool = 1;
+                break;
+            case 'd':
+                p->dims = atoi(optarg);
+                break;
+            case 'n':
+                p->samples = atol(optarg);
+                break;
+            case 'l':
+                p->sobol = 1;
+                break;
+            case 'p':
+                p->pipeline = 1;
+                break;
             case 'h':
                 if(p->rank == 0) usage();
                 exit(0);
@@ -188,9 +810,23 @@ int main(int argc, char *argv[])
     p.rank = rank;
     p.size = size-1;
     p.func = rectangle_rule;
+    p.adaptive = NULL;
+    p.romberg = 0;
+    p.panels = 0;
+    p.pool = 0;
+    p.dims = 0;
+    p.sobol = 0;
+    p.samples = 1000000;
+    p.pipeline = 0;
     
     /* Check for user options */
     parse_args(argc,argv,&p);
+    if(p.sobol && p.dims > SOBOL_MAX_DIMS)
+    {
+        if(rank == 0) fprintf(stderr,"Error: Sobol points support at most %d dimensions.\n",SOBOL_MAX_DIMS);
+        MPI_Finalize();
+        return -1;
+    }
     
     if(rank == 0)
         master(&p);
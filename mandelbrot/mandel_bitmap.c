@@ -9,10 +9,14 @@
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 #include <mpi.h>
 #define		X_RESN	15000   /* x resolution */
 #define		Y_RESN	10000   /* y resolution */
 #define     M_MAX   1048576       /* Max iterations for Mandelbrot */
+#define     ANIM_X_RESN 1920    /* default x resolution of an animation frame */
+#define     ANIM_Y_RESN 1080    /* default y resolution of an animation frame */
+#define     ANIM_SLOTS  3       /* frames that may be in flight (computing or writing) */
 // BITMAP header
 #pragma pack(push, 1)
 typedef struct
@@ -113,12 +117,22 @@ typedef struct complextype
 
 typedef enum { DATA_TAG, TERM_TAG, RESULT_TAG} Tags;
 
-Pixel cal_pixel(Compl c,int size,int rank)
+/* Color for a point that escaped after count iterations */
+Pixel shade(uint64_t count,int size,int rank)
 {
     Pixel result;
-    uint64_t count;
     uint64_t colors = 0xFFFFFF / M_MAX;
-    int rcolors = 0xFF / size;
+    result.b = rank*count*colors & 0xFF;
+    result.g = rank*count*colors;
+    //result.r = z.real 
+    //result.r = rank*rcolors & 0xFF0000;
+    result.r = rank*colors % count;
+    return result;
+}
+
+Pixel cal_pixel(Compl c,int size,int rank)
+{
+    uint64_t count;
     Compl z;
     float temp, lengthsq;
     z.real = 0; z.imag = 0;
@@ -131,13 +145,150 @@ Pixel cal_pixel(Compl c,int size,int rank)
         lengthsq = z.real * z.real + z.imag * z.imag;
         count++;
     } while((lengthsq < 4.0) && (count < M_MAX));
-    result.b = rank*count*colors & 0xFF;
-    result.g = rank*count*colors;
-    //result.r = z.real 
-    //result.r = rank*rcolors & 0xFF0000;
-    result.r = rank*colors % count;
-    return result;
+    return shade(count,size,rank);
 }
+
+/* Deep zoom (perturbation theory).
+   Past a zoom of about 1e-6 neighbouring pixels are no longer distinct in float, so the
+   master iterates a single reference point Z_n in extended precision and every pixel
+   c = C + dc only iterates its offset from that orbit in double:
+       d_{n+1} = 2 Z_n d_n + d_n^2 + dc
+   The first iterations are skipped with the series d_n = A_n dc + B_n dc^2 + C_n dc^3. */
+#ifdef __SIZEOF_FLOAT128__
+typedef __float128 Real;
+#else
+typedef long double Real;
+#endif
+
+/* Reference orbit, rounded to double once computed */
+typedef struct
+{
+    int length;         /* number of points, the last one may have escaped */
+    double * re, * im;
+} Orbit;
+
+/* Series approximation coefficients for one frame */
+typedef struct
+{
+    int frame, skip;
+    double ar, ai, br, bi, cr, ci;
+} Series;
+
+/* Parse a decimal number (e.g. -0.743643887037158704752191506114774e0) into full precision */
+Real parse_real(const char * str)
+{
+    Real value = 0, scale = 1;
+    int sign = 1, exponent = 0, frac = 0, dot = 0;
+    if(*str == '-' || *str == '+')
+        sign = (*str++ == '-') ? -1 : 1;
+    for(; *str; str++)
+    {
+        if(*str == '.')
+            dot = 1;
+        else if(*str >= '0' && *str <= '9')
+        {
+            value = value * 10 + (*str - '0');
+            frac += dot;
+        }
+        else if(*str == 'e' || *str == 'E')
+        {
+            exponent = atoi(str+1);
+            break;
+        }
+    }
+    for(exponent -= frac; exponent > 0; exponent--)
+        scale *= 10;
+    for(; exponent < 0; exponent++)
+        scale /= 10;
+    return sign * value * scale;
+}
+
+/* Iterate the reference point in extended precision (master only) */
+void reference_orbit(Orbit * o, Real cr, Real ci)
+{
+    Real zr = 0, zi = 0, temp;
+    int n;
+    o->re = malloc(sizeof(double) * M_MAX);
+    o->im = malloc(sizeof(double) * M_MAX);
+    for(n = 0; n < M_MAX; n++)
+    {
+        o->re[n] = (double) zr;
+        o->im[n] = (double) zi;
+        if(zr*zr + zi*zi > 4)
+        {
+            n++;
+            break;
+        }
+        temp = zr*zr - zi*zi + cr;
+        zi = 2*zr*zi + ci;
+        zr = temp;
+    }
+    o->length = n;
+}
+
+/* Compute the series coefficients and how many iterations they can skip.
+   dmax is the largest offset from the reference inside the frame. */
+void series_approx(Orbit * o, Series * s, double dmax)
+{
+    double ar = 0, ai = 0, br = 0, bi = 0, cr = 0, ci = 0;
+    double nar, nai, nbr, nbi, ncr, nci, zr, zi;
+    int n;
+    s->skip = 0;
+    s->ar = s->ai = s->br = s->bi = s->cr = s->ci = 0;
+    for(n = 0; n < o->length - 2; n++)
+    {
+        zr = o->re[n];
+        zi = o->im[n];
+        /* A' = 2ZA + 1, B' = 2ZB + A^2, C' = 2ZC + 2AB */
+        nar = 2*(zr*ar - zi*ai) + 1;
+        nai = 2*(zr*ai + zi*ar);
+        nbr = 2*(zr*br - zi*bi) + ar*ar - ai*ai;
+        nbi = 2*(zr*bi + zi*br) + 2*ar*ai;
+        ncr = 2*(zr*cr - zi*ci) + 2*(ar*br - ai*bi);
+        nci = 2*(zr*ci + zi*cr) + 2*(ar*bi + ai*br);
+        /* Stop once the cubic term is no longer negligible next to the quadratic one */
+        if(hypot(ncr,nci) * dmax > 1e-3 * hypot(nbr,nbi) && n > 0)
+            break;
+        ar = nar; ai = nai; br = nbr; bi = nbi; cr = ncr; ci = nci;
+        s->skip = n+1;
+        s->ar = ar; s->ai = ai; s->br = br; s->bi = bi; s->cr = cr; s->ci = ci;
+    }
+}
+
+/* Iteration count of the pixel at offset dc from the reference */
+uint64_t perturb_pixel(Orbit * o, Series * s, double dcr, double dci)
+{
+    double dr, di, zr, zi, temp, d2r, d2i;
+    uint64_t count = s->skip;
+    int n = s->skip;
+    /* d = A dc + B dc^2 + C dc^3 */
+    d2r = dcr*dcr - dci*dci;
+    d2i = 2*dcr*dci;
+    dr = s->ar*dcr - s->ai*dci + s->br*d2r - s->bi*d2i + s->cr*(d2r*dcr - d2i*dci) - s->ci*(d2r*dci + d2i*dcr);
+    di = s->ar*dci + s->ai*dcr + s->br*d2i + s->bi*d2r + s->cr*(d2r*dci + d2i*dcr) + s->ci*(d2r*dcr - d2i*dci);
+    while(count < M_MAX)
+    {
+        zr = o->re[n] + dr;
+        zi = o->im[n] + di;
+        if(zr*zr + zi*zi >= 4.0)
+            break;
+        /* Rebase onto the start of the orbit when the pixel gets closer to 0 than to the
+           reference, or when the reference runs out; this avoids glitches */
+        if(zr*zr + zi*zi < dr*dr + di*di || n == o->length - 1)
+        {
+            dr = zr;
+            di = zi;
+            n = 0;
+        }
+        temp = 2*(o->re[n]*dr - o->im[n]*di) + dr*dr - di*di + dcr;
+        di = 2*(o->re[n]*di + o->im[n]*dr) + 2*dr*di + dci;
+        dr = temp;
+        n++;
+        count++;
+    }
+    return count;
+}
+
 void worker(int linebytes)
 {
     Pixel * colors = malloc(linebytes);
@@ -163,6 +314,253 @@ void worker(int linebytes)
     }
 }
 
+/* Parameters of a zoom animation */
+typedef struct
+{
+    int frames, width, height;
+    double cx, cy;      /* center of the zoom */
+    double span;        /* width of the first frame in the complex plane */
+    double zoom;        /* magnification between consecutive frames */
+    int deep;           /* render with perturbation against a reference orbit */
+    char cx_str[128], cy_str[128]; /* center as given, parsed in full precision for deep zooms */
+    char prefix[256];   /* output is written to <prefix>_<frame>.bmp */
+} Anim;
+
+/* A frame buffer that is either being filled by the workers or written to disk */
+typedef struct
+{
+    int frame;          /* frame held by this slot, -1 if free */
+    int rows;           /* rows received so far */
+    int writing;        /* set while the asynchronous write is pending */
+    uint8_t * data;     /* headers followed by the pixel rows, in file order */
+    MPI_File fh;
+    MPI_Request request;
+} Slot;
+
+/* Worker for animation mode: tasks are (frame,row) pairs, rows are returned with tag = row */
+void anim_worker(Anim * a, Orbit * o, int linebytes)
+{
+    Pixel * colors = calloc(1, linebytes);
+    MPI_Status status;
+    int task[2], x, rank, size;
+    double pixel;
+    Compl c;
+    Series series;
+    series.frame = -1;
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    MPI_Recv(task, 2, MPI_INT, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+    while(status.MPI_TAG != TERM_TAG)
+    {
+        pixel = a->span / pow(a->zoom, task[0]) / a->width;
+        if(a->deep)
+        {
+            if(series.frame != task[0])
+            {
+                series_approx(o, &series, hypot(a->width, a->height) / 2 * pixel);
+                series.frame = task[0];
+            }
+            for(x = 0; x < a->width; x++)
+                colors[x] = shade(perturb_pixel(o, &series, (x - a->width/2) * pixel,
+                                                (task[1] - a->height/2) * pixel), rank, size);
+        }
+        else
+        {
+            c.imag = a->cy + (task[1] - a->height/2) * pixel;
+            for(x = 0; x < a->width; x++)
+            {
+                c.real = a->cx + (x - a->width/2) * pixel;
+                colors[x] = cal_pixel(c,rank,size);
+            }
+        }
+        MPI_Send(&colors[0], linebytes, MPI_BYTE, 0, task[1], MPI_COMM_WORLD);
+        MPI_Recv(task, 2, MPI_INT, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+    }
+    free(colors);
+}
+
+/* Start writing a completed frame without waiting for the file system */
+void anim_write(Anim * a, BMP * bmp, Slot * s)
+{
+    char filename[300];
+    snprintf(filename, sizeof(filename), "%s_%04d.bmp", a->prefix, s->frame);
+    memcpy(s->data, &bmp->header, sizeof(bmp->header));
+    memcpy(s->data + sizeof(bmp->header), &bmp->iheader, sizeof(bmp->iheader));
+    if(MPI_File_open(MPI_COMM_SELF, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &s->fh) != MPI_SUCCESS)
+    {
+        fprintf(stderr,"Cannot create file %s\n", filename);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_set_size(s->fh, bmp->header.size);
+    MPI_File_iwrite_at(s->fh, 0, s->data, bmp->header.size, MPI_BYTE, &s->request);
+    s->writing = 1;
+}
+
+/* Finish a pending write and release the slot */
+void anim_finish(Slot * s)
+{
+    MPI_Wait(&s->request, MPI_STATUS_IGNORE);
+    MPI_File_close(&s->fh);
+    s->writing = 0;
+    s->frame = -1;
+}
+
+/* Master for animation mode.
+   Rows of every frame are handed out from one continuous stream, so workers move on to
+   frame k+1 while the last rows of frame k are still being computed, and finished frames
+   are written with non-blocking MPI-IO while the workers keep going. */
+void anim_master(Anim * a, BMP * bmp, int linebytes, int size)
+{
+    Slot slots[ANIM_SLOTS];
+    int * assigned = malloc(sizeof(int) * size);    /* frame each worker is computing */
+    int * idle = malloc(sizeof(int) * size);        /* workers waiting for a free slot */
+    int nidle = 0, active = 0, done = 0;
+    int frame = 0, row = 0, task[2], k, i;
+    double start = MPI_Wtime();
+    MPI_Status status;
+    Slot * s;
+
+    for(i = 0; i < ANIM_SLOTS; i++)
+    {
+        slots[i].frame = -1;
+        slots[i].rows = 0;
+        slots[i].writing = 0;
+        slots[i].data = malloc(bmp->header.size);
+    }
+    for(k = 1; k < size; k++)
+        idle[nidle++] = k;
+
+    while(done < a->frames)
+    {
+        /* Hand out work to every idle worker that can get some */
+        while(nidle > 0)
+        {
+            k = idle[nidle-1];
+            if(frame >= a->frames)
+            {
+                MPI_Send(task, 2, MPI_INT, k, TERM_TAG, MPI_COMM_WORLD);
+                nidle--;
+                continue;
+            }
+            s = &slots[frame % ANIM_SLOTS];
+            if(s->frame != frame)
+            {
+                /* Slot still holds an older frame: reclaim it once its write has been posted */
+                if(s->frame != -1 && !s->writing)
+                    break;
+                if(s->writing)
+                    anim_finish(s);
+                s->frame = frame;
+                s->rows = 0;
+            }
+            task[0] = frame;
+            task[1] = row;
+            MPI_Send(task, 2, MPI_INT, k, DATA_TAG, MPI_COMM_WORLD);
+            assigned[k] = frame;
+            nidle--;
+            active++;
+            if(++row == a->height)
+            {
+                row = 0;
+                frame++;
+            }
+        }
+        if(active == 0)
+            break;
+
+        /* Receive a row straight into the frame it belongs to */
+        MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        s = &slots[assigned[status.MPI_SOURCE] % ANIM_SLOTS];
+        MPI_Recv(s->data + bmp->header.offset + (a->height-1-status.MPI_TAG) * linebytes, linebytes,
+                 MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        idle[nidle++] = status.MPI_SOURCE;
+        active--;
+        if(++s->rows == a->height)
+        {
+            fprintf(stderr,"Frame %d done, %f s/frame\n", s->frame, (MPI_Wtime()-start)/(s->frame+1));
+            anim_write(a, bmp, s);
+            done++;
+        }
+    }
+    /* Release any worker still waiting and wait for the outstanding writes */
+    while(nidle > 0)
+        MPI_Send(task, 2, MPI_INT, idle[--nidle], TERM_TAG, MPI_COMM_WORLD);
+    for(i = 0; i < ANIM_SLOTS; i++)
+    {
+        if(slots[i].writing)
+            anim_finish(&slots[i]);
+        free(slots[i].data);
+    }
+    fprintf(stderr,"Rendered %d frames in %f s\n", a->frames, MPI_Wtime()-start);
+    free(assigned);
+    free(idle);
+}
+
+void usage()
+{
+    printf("mandel_bitmap\n\
+            MPI Program to render the Mandelbrot set to dot.bmp.\n\
+            Usage: mandel_bitmap [args]\n\
+            -f <frames>\tRender a zoom animation of <frames> frames instead\n\
+            -z <zoom>\tMagnification between frames (default 1.1)\n\
+            -x <real>\tReal part of the zoom center\n\
+            -y <imag>\tImaginary part of the zoom center\n\
+            -s <span>\tWidth of the first frame in the complex plane\n\
+            -d\t\tDeep zoom: perturbation against a high precision reference orbit\n\
+            -W <width>\tFrame width in pixels\n\
+            -H <height>\tFrame height in pixels\n\
+            -o <prefix>\tFrame file prefix (default frame)\n\
+            -h\t\tPrint this message\n");
+}
+
+/* Parse user arguments */
+void parse_args(int argc, char ** argv, Anim * a, int rank)
+{
+    int c = 0;
+    while((c = getopt(argc,argv,"f:z:x:y:s:dW:H:o:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'f':
+                a->frames = atoi(optarg);
+                break;
+            case 'z':
+                a->zoom = atof(optarg);
+                break;
+            case 'x':
+                a->cx = atof(optarg);
+                strncpy(a->cx_str,optarg,sizeof(a->cx_str)-1);
+                break;
+            case 'y':
+                a->cy = atof(optarg);
+                strncpy(a->cy_str,optarg,sizeof(a->cy_str)-1);
+                break;
+            case 's':
+                a->span = atof(optarg);
+                break;
+            case 'd':
+                a->deep = 1;
+                break;
+            case 'W':
+                a->width = atoi(optarg);
+                break;
+            case 'H':
+                a->height = atoi(optarg);
+                break;
+            case 'o':
+                strncpy(a->prefix,optarg,sizeof(a->prefix)-1);
+                break;
+            case 'h':
+                if(rank == 0) usage();
+                MPI_Finalize();
+                exit(0);
+            default:
+                break;
+        }
+    }
+    return;
+}
+
 int main (int argc, char **argv)
 {
     int rank, size;
@@ -187,6 +585,64 @@ int main (int argc, char **argv)
     bmp.iheader.impcolors = 0;
     bmp.iheader.height = Y_RESN;
     //block
+
+    /* Animation defaults: same view as the single image */
+    Anim anim;
+    anim.frames = 0;
+    anim.width = ANIM_X_RESN;
+    anim.height = ANIM_Y_RESN;
+    anim.cx = (X_RESN/2 - 8000)/3500.0;
+    anim.cy = (Y_RESN/2 - 5500)/3500.0;
+    anim.span = X_RESN/3500.0;
+    anim.zoom = 1.1;
+    anim.deep = 0;
+    strcpy(anim.prefix, "frame");
+    snprintf(anim.cx_str, sizeof(anim.cx_str), "%.17g", anim.cx);
+    snprintf(anim.cy_str, sizeof(anim.cy_str), "%.17g", anim.cy);
+    parse_args(argc, argv, &anim, rank);
+    if(anim.deep && anim.frames == 0)
+        anim.frames = 1;
+    if(anim.frames > 0)
+    {
+        /* The master computes the reference orbit once, every worker gets a copy */
+        Orbit orbit;
+        if(anim.deep)
+        {
+            if(rank == 0)
+            {
+                double t = MPI_Wtime();
+                reference_orbit(&orbit, parse_real(anim.cx_str), parse_real(anim.cy_str));
+                fprintf(stderr,"Reference orbit: %d iterations, %f s\n", orbit.length, MPI_Wtime()-t);
+            }
+            MPI_Bcast(&orbit.length, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            if(rank != 0)
+            {
+                orbit.re = malloc(sizeof(double) * orbit.length);
+                orbit.im = malloc(sizeof(double) * orbit.length);
+            }
+            MPI_Bcast(orbit.re, orbit.length, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            MPI_Bcast(orbit.im, orbit.length, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        }
+        int linebytes = ((anim.width * bmp.iheader.bits + 31)/32)*4;
+        bmp.iheader.width = anim.width;
+        bmp.iheader.height = anim.height;
+        bmp.iheader.planes = 1;
+        bmp.iheader.isize = linebytes * bmp.iheader.height;
+        bmp.header.offset = 54;
+        bmp.header.size = bmp.header.offset + bmp.iheader.isize;
+        if(rank != 0)
+            anim_worker(&anim, &orbit, linebytes);
+        else
+            anim_master(&anim, &bmp, linebytes, size);
+        if(anim.deep)
+        {
+            free(orbit.re);
+            free(orbit.im);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Finalize();
+        return 0;
+    }
    FILE * fp = 0;
     if((fp = fopen("dot.bmp","r+")) == NULL)
     {
@@ -13,111 +13,178 @@
 #include<pthread.h>
 #include<sys/wait.h>
 #include<unistd.h>
+#include<sched.h>
+#include<stdatomic.h>
 #define INFINITY 2147483647
 #define DEFAULT_NUM_PROCS 2
+#define EMPTY -1
+#define ABORT -2
 enum status { REQUEST, QUEUE, TERMINATE,VERTEX };
 
-
-typedef struct vertex
-{
-    int name;
-    struct vertex * next;
-} vertex;
-
-typedef struct vertex_queue
+// Chase-Lev work stealing deque of vertex names.
+// The owner pushes and takes at the bottom, other threads steal from the top.
+// A vertex is in at most one deque at a time, so a ring of count slots never fills
+// and is allocated once, nothing is malloc'd while relaxing.
+typedef struct deque
 {
-    int count;
-    int request_count;
-    vertex * head;
-} vertex_queue;
+    atomic_long top;
+    atomic_long bottom;
+    long mask;
+    atomic_int * ring;
+    // keep the deques of different threads on different cache lines
+    char pad[64];
+} deque;
 
 typedef struct workinfo
 {
     int num_procs;
     int count;
     int * graph;
-    vertex_queue * queue;
-    unsigned int * dist;
-    int master;
-    int terminate;
-    pthread_mutex_t * dist_lock;
-    pthread_mutex_t * queue_lock;
-    pthread_cond_t * termination_cond;
+    atomic_uint * dist;
+    // per vertex: 1 while it waits in some deque
+    atomic_int * queued;
+    // vertices queued or being relaxed, the search is over when this reaches 0
+    atomic_long pending;
+    deque * deques;
 } workinfo;
-static void *do_slave(void *arg);
-static void *do_master(void *arg);
 
-static void *do_slave(void *arg)
+typedef struct threadinfo
 {
-    workinfo * info = (workinfo *) arg;
-    vertex temp;
-    int * graph = (int*) info->graph;
-    int * dist = (int*) info->dist;
-    int count = info->count;
-    unsigned int temp_dist;
-    int j;
-    vertex_queue * queue = (vertex_queue*)info->queue;
-    while(!info->terminate)
+    workinfo * info;
+    int id;
+    unsigned int seed;
+} threadinfo;
+
+static void deque_init(deque * d, int count)
+{
+    long size = 1;
+    while(size < count + 1)
+        size *= 2;
+    d->ring = (atomic_int *) malloc(sizeof(atomic_int)*size);
+    d->mask = size - 1;
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+}
+
+// owner only
+static void deque_push(deque * d, int x)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    atomic_store_explicit(&d->ring[b & d->mask], x, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+// owner only, returns EMPTY if there is nothing left
+static int deque_take(deque * d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    long t;
+    int x = EMPTY;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if(t <= b)
     {
-        pthread_mutex_lock(info->queue_lock);
-               // fprintf(stderr,"Queue: %d request_count: %d\n",queue->count,queue->request_count);
-        // queue is empty
-        if(queue->count == 0)
+        x = atomic_load_explicit(&d->ring[b & d->mask], memory_order_relaxed);
+        // last element, race the thieves for it
+        if(t == b)
         {
-            queue->request_count = queue->request_count + 1;
-            pthread_mutex_unlock(info->queue_lock);
-            continue;
-        }
-        // queue is non empty
-        else if(queue->count > 0)
-        {
-            temp.name = queue->head->name;
-            queue->count = queue->count - 1;
-            if(queue->count > 1)
-                queue->head = queue->head->next;
-        }
-        pthread_mutex_unlock(info->queue_lock);
-        for(j = 1; j < count; j++)
-        {
-            temp_dist = graph[temp.name*count+j];
-            if(temp_dist != INFINITY)
-            {
-                temp_dist += dist[temp.name];
-                if(temp_dist < dist[j])
-                {
-                    pthread_mutex_lock(info->queue_lock);
-                    dist[j] = temp_dist;
-                    vertex * temp = (vertex *) malloc(sizeof(vertex));
-                    temp->name = j;
-                    temp->next = queue->head;
-                    queue->count = queue->count+1;
-                    queue->head = temp;
-                    if(queue->request_count > 0)
-                        queue->request_count = queue->request_count - 1;
-                    pthread_mutex_unlock(info->queue_lock);
-                }
-            }
+            if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+                x = EMPTY;
+            atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
         }
     }
-pthread_exit(0);
+    else
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return x;
+}
+
+// any thread, returns EMPTY or ABORT if another thread won the element
+static int deque_steal(deque * d)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b;
+    int x;
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if(t >= b)
+        return EMPTY;
+    x = atomic_load_explicit(&d->ring[t & d->mask], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return ABORT;
+    return x;
+}
+
+// queue vertex v on my deque unless it is already waiting somewhere
+static void enqueue(workinfo * info, deque * mine, int v)
+{
+    if(atomic_exchange(&info->queued[v], 1) == 0)
+    {
+        atomic_fetch_add(&info->pending, 1);
+        deque_push(mine, v);
+    }
 }
-static void *do_master(void *arg)
+
+// next vertex for thread id: its own deque first, then steal from random victims
+static int next_vertex(threadinfo * me)
 {
-    workinfo * info = (workinfo *) arg;
+    workinfo * info = me->info;
+    int v, i, victim;
     while(1)
     {
-        pthread_mutex_lock(info->queue_lock);
-        if(info->queue->count == 0 && info->queue->request_count >= info->num_procs-1)
+        v = deque_take(&info->deques[me->id]);
+        if(v >= 0)
+            return v;
+        for(i = 0; i < 2*info->num_procs; i++)
         {
-            info->terminate = 1;
-            pthread_mutex_unlock(info->queue_lock);
-            break;
+            victim = rand_r(&me->seed) % info->num_procs;
+            if(victim == me->id)
+                continue;
+            v = deque_steal(&info->deques[victim]);
+            if(v >= 0)
+                return v;
         }
-        pthread_mutex_unlock(info->queue_lock);
+        if(atomic_load(&info->pending) == 0)
+            return EMPTY;
+        // nothing to steal right now, let the busy threads run
+        sched_yield();
+    }
+}
 
+static void *do_slave(void *arg)
+{
+    threadinfo * me = (threadinfo *) arg;
+    workinfo * info = me->info;
+    deque * mine = &info->deques[me->id];
+    int * graph = info->graph;
+    atomic_uint * dist = info->dist;
+    int count = info->count;
+    unsigned int temp_dist, old, d;
+    int v, j;
+    while((v = next_vertex(me)) != EMPTY)
+    {
+        // an improvement to v from now on queues it again
+        atomic_store(&info->queued[v], 0);
+        d = atomic_load(&dist[v]);
+        for(j = 1; j < count; j++)
+        {
+            temp_dist = graph[v*count+j];
+            if(temp_dist != INFINITY)
+            {
+                temp_dist += d;
+                // lower dist[j] without a lock
+                old = atomic_load_explicit(&dist[j], memory_order_relaxed);
+                while(temp_dist < old && !atomic_compare_exchange_weak(&dist[j], &old, temp_dist));
+                if(temp_dist < old)
+                    enqueue(info, mine, j);
+            }
+        }
+        atomic_fetch_sub(&info->pending, 1);
     }
     pthread_exit(0);
 }
+
 int main(int argc, char * argv[])
 {
     // variable declarations:
@@ -131,7 +198,7 @@ int main(int argc, char * argv[])
     
 
     // array to store distances
-    unsigned int * dist; 
+    atomic_uint * dist; 
 
     // size of graph as a string
     char char_count[12];
@@ -169,6 +236,11 @@ int main(int argc, char * argv[])
                 break;
         }
     }
+    if(num_procs < 1)
+    {
+        fprintf(stderr,"Number of threads (-n) must be at least 1\n");
+        exit(-1);
+    }
 
     // Open input file
     input = fopen(filename,"r");
@@ -182,7 +254,7 @@ int main(int argc, char * argv[])
     count = atoi(char_count);
 
     graph = (int*) malloc(count*count*sizeof(int));
-    dist = (unsigned int*) malloc(sizeof(unsigned int)*count);
+    dist = (atomic_uint*) malloc(sizeof(atomic_uint)*count);
 
     // Read in graph
     // instead of storing the graph matrix as a 2d array, I use a 1d array
@@ -204,52 +276,40 @@ int main(int argc, char * argv[])
     // Begin at node zero, so get distance from 0 to every other node
     // note: this array is shared
     for(i = 0; i < count; i++)
-        dist[i] = graph[i];
+        atomic_init(&dist[i], graph[i]);
 
     
     // start the clock
     clock_gettime(CLOCK_REALTIME, &start);
-    vertex_queue queue;
-    queue.count = 0;
-    queue.request_count = 0;
-    vertex root;
-    root.name = 0;
-    queue.head = &root;
-    pthread_mutex_t dist_lock = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-    pthread_cond_t termination_cond;
-
     workinfo info;
-    info.terminate = 0;
     info.count = count;
     info.graph = graph;
     info.dist = dist;
-    info.master = 0;
-    info.queue_lock = &queue_lock;
-    info.dist_lock = &dist_lock;
-    info.termination_cond = &termination_cond;
     info.num_procs = num_procs;
-    info.queue = &queue;
+    info.queued = (atomic_int *) malloc(sizeof(atomic_int)*count);
+    info.deques = (deque *) malloc(sizeof(deque)*num_procs);
+    atomic_init(&info.pending, 0);
+    for(i = 0; i < count; i++)
+        atomic_init(&info.queued[i], 0);
+    for(i = 0; i < num_procs; i++)
+        deque_init(&info.deques[i], count);
 
-    vertex * temp;
+    // if the distance is not INFINITY, add the node to a queue, dealt out over the threads
+    // (the threads do not run yet, so pushing on their deques is safe)
     for(i = 0; i < count; i++)
-        // if the distance is not INFINITY, add the node to the queue
-        if(dist[i] != INFINITY)
-        {
-            temp = (vertex *) malloc(sizeof(vertex));
-            temp->next = queue.head;
-            temp->name = i;
-            queue.count = queue.count + 1;
-            queue.head = temp;
-        }
-        
-    pthread_t * threads = (pthread_t *) malloc(sizeof(pthread_t)*num_procs);
-    if(pthread_create(&threads[0],NULL,do_master, (void*)&info)<0)
-        perror("pthread_create");
+        if(atomic_load(&dist[i]) != INFINITY)
+            enqueue(&info, &info.deques[i % num_procs], i);
 
-    for(i = 1;i < num_procs; i++)
-        if(pthread_create(&threads[i],NULL,do_slave, (void*)&info)<0)
+    pthread_t * threads = (pthread_t *) malloc(sizeof(pthread_t)*num_procs);
+    threadinfo * args = (threadinfo *) malloc(sizeof(threadinfo)*num_procs);
+    for(i = 0;i < num_procs; i++)
+    {
+        args[i].info = &info;
+        args[i].id = i;
+        args[i].seed = i + 1;
+        if(pthread_create(&threads[i],NULL,do_slave, (void*)&args[i]))
             perror("pthread_create");
+    }
     for(i = 0;i < num_procs; i++)
         if(pthread_join(threads[i],NULL))
             perror("pthread_join");
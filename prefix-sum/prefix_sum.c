@@ -6,72 +6,370 @@
 
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
 #include<string.h>
+#include<unistd.h>
 #include<mpi.h>
+#include "scan.h"
 
+/* Default number of elements */
 #define ARRAY_SIZE 1048576
+#define BLOCK_LOW(id,p,n) ((long)(id)*(n)/(p))
+
+/* Inclusive scan of a chunk in place, returns the chunk total.
+   The inscan reduction lets the compiler vectorize the loop (-fopenmp-simd). */
+int64_t local_scan_i64(int64_t * chunk, long n)
+{
+    int64_t sum = 0;
+    long i;
+#pragma omp simd reduction(inscan, +:sum)
+    for(i = 0; i < n; i++)
+    {
+        sum += chunk[i];
+#pragma omp scan inclusive(sum)
+        chunk[i] = sum;
+    }
+    return sum;
+}
+
+double local_scan_double(double * chunk, long n)
+{
+    double sum = 0;
+    long i;
+#pragma omp simd reduction(inscan, +:sum)
+    for(i = 0; i < n; i++)
+    {
+        sum += chunk[i];
+#pragma omp scan inclusive(sum)
+        chunk[i] = sum;
+    }
+    return sum;
+}
+
+/* Add the sum of all lower ranks' chunks to every element */
+void add_offset_i64(int64_t * chunk, long n, int64_t offset)
+{
+    long i;
+#pragma omp simd
+    for(i = 0; i < n; i++)
+        chunk[i] += offset;
+}
+
+void add_offset_double(double * chunk, long n, double offset)
+{
+    long i;
+#pragma omp simd
+    for(i = 0; i < n; i++)
+        chunk[i] += offset;
+}
+
+/* Distributed inclusive scan: local scan, one MPI_Exscan of the chunk totals, offset add */
+void scan_i64(int64_t * chunk, long n, MPI_Comm comm)
+{
+    int64_t total = local_scan_i64(chunk, n), offset = 0;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Exscan(&total, &offset, 1, MPI_INT64_T, MPI_SUM, comm);
+    /* The result on rank 0 is undefined */
+    if(rank != 0)
+        add_offset_i64(chunk, n, offset);
+}
+
+void scan_double(double * chunk, long n, MPI_Comm comm)
+{
+    double total = local_scan_double(chunk, n), offset = 0;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Exscan(&total, &offset, 1, MPI_DOUBLE, MPI_SUM, comm);
+    if(rank != 0)
+        add_offset_double(chunk, n, offset);
+}
+
+/* Per thread partial sums, padded so that no two threads write the same cache line */
+typedef struct
+{
+    int64_t sum;
+    char pad[64 - sizeof(int64_t)];
+} PartialI64;
+
+typedef struct
+{
+    double sum;
+    char pad[64 - sizeof(double)];
+} PartialDouble;
+
+/* Threaded scan of the chunk, combined with MPI_Exscan across ranks for hybrid runs.
+   Each thread scans its block, the block totals are scanned serially, then every thread
+   adds its block offset plus the rank offset in a single pass over its block. */
+void scan_i64_threaded(int64_t * chunk, long n, int threads, MPI_Comm comm)
+{
+    PartialI64 * partial = (PartialI64 *) aligned_alloc(64, sizeof(PartialI64) * threads);
+    int64_t total = 0, offset = 0, temp;
+    int rank, b;
+    MPI_Comm_rank(comm, &rank);
+#pragma omp parallel for num_threads(threads) schedule(static,1)
+    for(b = 0; b < threads; b++)
+        partial[b].sum = local_scan_i64(&chunk[n*b/threads], n*(b+1)/threads - n*b/threads);
+    for(b = 0; b < threads; b++)
+    {
+        temp = partial[b].sum;
+        partial[b].sum = total;
+        total += temp;
+    }
+    MPI_Exscan(&total, &offset, 1, MPI_INT64_T, MPI_SUM, comm);
+    if(rank == 0)
+        offset = 0;
+#pragma omp parallel for num_threads(threads) schedule(static,1)
+    for(b = 0; b < threads; b++)
+        if(partial[b].sum + offset != 0)
+            add_offset_i64(&chunk[n*b/threads], n*(b+1)/threads - n*b/threads, partial[b].sum + offset);
+    free(partial);
+}
+
+void scan_double_threaded(double * chunk, long n, int threads, MPI_Comm comm)
+{
+    PartialDouble * partial = (PartialDouble *) aligned_alloc(64, sizeof(PartialDouble) * threads);
+    double total = 0, offset = 0, temp;
+    int rank, b;
+    MPI_Comm_rank(comm, &rank);
+#pragma omp parallel for num_threads(threads) schedule(static,1)
+    for(b = 0; b < threads; b++)
+        partial[b].sum = local_scan_double(&chunk[n*b/threads], n*(b+1)/threads - n*b/threads);
+    for(b = 0; b < threads; b++)
+    {
+        temp = partial[b].sum;
+        partial[b].sum = total;
+        total += temp;
+    }
+    MPI_Exscan(&total, &offset, 1, MPI_DOUBLE, MPI_SUM, comm);
+    if(rank == 0)
+        offset = 0;
+#pragma omp parallel for num_threads(threads) schedule(static,1)
+    for(b = 0; b < threads; b++)
+        if(partial[b].sum + offset != 0)
+            add_offset_double(&chunk[n*b/threads], n*(b+1)/threads - n*b/threads, partial[b].sum + offset);
+    free(partial);
+}
+
+/* Value of element i of the generated input, from a hash of i so that any rank can
+   generate its own block and the input does not depend on the number of ranks */
+int64_t generate(long i)
+{
+    uint64_t z = (uint64_t) i * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (int64_t) ((z ^ (z >> 31)) % 1024);
+}
+
+void usage()
+{
+    printf("prefix_sum\n\
+            MPI Program to compute the prefix sum of an array.\n\
+            Usage: prefix_sum [args]\n\
+            -n <size>\tNumber of elements to generate\n\
+            -f <file>\tRead the elements from a raw binary file instead\n\
+            -o <file>\tWrite the prefix sums to a raw binary file\n\
+            -d\t\tScan doubles instead of 64 bit integers\n\
+            -t <threads>\tScan each rank's block with threads (OpenMP)\n\
+            -x\t\tExclusive scan (scan library)\n\
+            -m\t\tMaximum scan (scan library)\n\
+            -s <len>\tSegmented scan, a segment starts every <len> elements (scan library)\n\
+            -h\t\tPrint this message\n");
+}
 
 int main(int argc, char *argv[])
 {
 int rank;
 int size;
+int c;
+int use_double = 0;
+/* Scans done with the generic library, on 64 bit integers */
+int exclusive = 0, maximum = 0;
+long segment = 0;
+/* Threads per rank, 0 for the plain MPI scan */
+int threads = 0;
+int provided;
+double start, end;
+long array_size = ARRAY_SIZE;
+char * input = NULL, * output = NULL;
+MPI_File fh;
+MPI_Offset bytes;
 
-if(MPI_Init(&argc, &argv) != MPI_SUCCESS)
+/* The threaded scan only calls MPI from the master thread, between its OpenMP regions */
+if(MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided) != MPI_SUCCESS)
 {
     fprintf(stderr, "Unable to initialize MPI!\n");
     return -1;
 }
 MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 MPI_Comm_size(MPI_COMM_WORLD, &size);
-if(ARRAY_SIZE % size != 0 && rank == 0)
+while((c = getopt(argc,argv,"n:f:o:dxms:t:h")) != -1)
+{
+    switch(c)
+    {
+        case 'n':
+            array_size = atol(optarg);
+            break;
+        case 'f':
+            input = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'd':
+            use_double = 1;
+            break;
+        case 'x':
+            exclusive = 1;
+            break;
+        case 'm':
+            maximum = 1;
+            break;
+        case 's':
+            segment = atol(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'h':
+            if(rank == 0) usage();
+            MPI_Finalize();
+            return 0;
+        default:
+            break;
+    }
+}
+if(threads > 0 && provided < MPI_THREAD_FUNNELED)
+{
+    if(rank == 0) fprintf(stderr,"MPI library lacks MPI_THREAD_FUNNELED, scanning without threads\n");
+    threads = 0;
+}
+/* The library scans work on 64 bit integers, and segments restart an inclusive scan */
+if(use_double && (exclusive || maximum || segment > 0))
+{
+    if(rank == 0) fprintf(stderr,"-x, -m and -s scan 64 bit integers, they cannot be used with -d\n");
+    MPI_Finalize();
+    return -1;
+}
+if(exclusive && segment > 0)
+{
+    if(rank == 0) fprintf(stderr,"-x and -s cannot be combined, the segmented scan is inclusive\n");
+    MPI_Finalize();
+    return -1;
+}
+if(threads > 0 && (exclusive || maximum || segment > 0))
 {
-    fprintf(stderr,"Array size must be multiple of mpi job size.\n");
+    if(rank == 0) fprintf(stderr,"-t only threads the plain inclusive scan, not -x, -m or -s\n");
+    MPI_Finalize();
     return -1;
 }
-MPI_Status status;
-int * array = (int *) malloc(sizeof(int) * ARRAY_SIZE);
-int * chunk = (int *) malloc(sizeof(int) * ARRAY_SIZE/size);
-int i = 0;
+/* Both element types are 8 bytes */
+size_t width = use_double ? sizeof(double) : sizeof(int64_t);
+if(input)
+{
+    if(MPI_File_open(MPI_COMM_WORLD, input, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        if(rank == 0) fprintf(stderr,"Unable to open %s\n",input);
+        MPI_Finalize();
+        return -1;
+    }
+    MPI_File_get_size(fh, &bytes);
+    array_size = bytes / width;
+}
+
+/* Uneven blocks: rank r owns elements [BLOCK_LOW(r), BLOCK_LOW(r+1)) */
+long low = BLOCK_LOW(rank,size,array_size);
+long n = BLOCK_LOW(rank+1,size,array_size) - low;
+int64_t * chunk = (int64_t *) malloc(width * (n > 0 ? n : 1));
+double * dchunk = (double *) chunk;
+long i = 0;
+
+/* Each rank reads or generates only its own block */
+if(input)
+{
+    MPI_File_read_at_all(fh, (MPI_Offset) low * width, chunk, n, use_double ? MPI_DOUBLE : MPI_INT64_T, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+}
+else
+    for(i = 0; i < n; i++)
+    {
+        if(use_double)
+            dchunk[i] = generate(low + i) / 1024.0;
+        else
+            chunk[i] = generate(low + i);
+    }
 
-int total_sum = 0;
-for(i = 0; i < ARRAY_SIZE; i++)
+/* The last prefix is the sum (or maximum) of the input elements in [from,to):
+   the exclusive scan leaves out the last element, the segmented one starts at the
+   last segment */
+long from = (segment > 0) ? (array_size-1) / segment * segment : 0;
+long to = exclusive ? array_size-1 : array_size;
+int64_t local_sum = 0, total_sum = 0, zero = 0;
+double local_dsum = 0, total_dsum = 0;
+for(i = 0; i < n; i++)
+{
+    if(use_double)
+        local_dsum += dchunk[i];
+    else if(low + i >= from && low + i < to)
+        local_sum = maximum ? (chunk[i] > local_sum ? chunk[i] : local_sum) : local_sum + chunk[i];
+}
+MPI_Reduce(&local_sum,&total_sum,1,MPI_INT64_T,maximum ? MPI_MAX : MPI_SUM,size-1,MPI_COMM_WORLD);
+MPI_Reduce(&local_dsum,&total_dsum,1,MPI_DOUBLE,MPI_SUM,size-1,MPI_COMM_WORLD);
+char * flags = NULL;
+if(segment > 0)
 {
-    array[i] = rand() % 1024;
-    total_sum+=array[i];
+    flags = (char *) malloc(n > 0 ? n : 1);
+    for(i = 0; i < n; i++)
+        flags[i] = ((low + i) % segment == 0);
 }
+ScanOp op;
+if(maximum)
+    scan_op_create(&op, sizeof(int64_t), combine_max_i64, &zero);
+else
+    scan_op_create(&op, sizeof(int64_t), combine_sum_i64, &zero);
 
 MPI_Barrier(MPI_COMM_WORLD);
-MPI_Scatter(array,ARRAY_SIZE/size,MPI_INT,chunk,ARRAY_SIZE/size,MPI_INT,0,MPI_COMM_WORLD);
-int sum = 0;
-int temp = 0;
-int key = 1;
-for(i = 0; i < ARRAY_SIZE/size; i++)
-    sum += chunk[i];
-
-/* Fancy stuff to keep the indexes correct */
-/* Number of processes participating halves each time */
-while(key <= size/2)
-{
-    if((rank+1) % key == 0)
-        if(rank/key % 2 == 0)
-        {
-            MPI_Send(&sum, 1, MPI_INT, rank+key,0,MPI_COMM_WORLD);
-        }
-        else
-        {
-            MPI_Recv(&temp, 1, MPI_INT, rank-key,0,MPI_COMM_WORLD,&status);
-            sum += temp;
-        }
-          key = 2 * key;
-        MPI_Barrier(MPI_COMM_WORLD);
-            
+start = MPI_Wtime();
+if(use_double && threads > 0)
+    scan_double_threaded(dchunk, n, threads, MPI_COMM_WORLD);
+else if(use_double)
+    scan_double(dchunk, n, MPI_COMM_WORLD);
+else if(threads > 0)
+    scan_i64_threaded(chunk, n, threads, MPI_COMM_WORLD);
+else if(exclusive)
+    scan_exclusive(chunk, n, &op, MPI_COMM_WORLD);
+else if(segment > 0)
+    scan_segmented(chunk, flags, n, &op, MPI_COMM_WORLD);
+else if(maximum)
+    scan_inclusive(chunk, n, &op, MPI_COMM_WORLD);
+else
+    scan_i64(chunk, n, MPI_COMM_WORLD);
+end = MPI_Wtime();
+scan_op_free(&op);
+free(flags);
+
+if(output)
+{
+    MPI_File_open(MPI_COMM_WORLD, output, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_write_at_all(fh, (MPI_Offset) low * width, chunk, n, use_double ? MPI_DOUBLE : MPI_INT64_T, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
 }
-if(rank == size-1)
+
+/* The last element of the last rank holds the total */
+if(rank == size-1 && n > 0)
 {
-    fprintf(stderr,"Total: %d\n",sum);
-    fprintf(stderr,"Correct Sum: %d\n",total_sum);
+    if(use_double)
+    {
+        fprintf(stderr,"Total: %f\n",dchunk[n-1]);
+        fprintf(stderr,"Correct Sum: %f\n",total_dsum);
+    }
+    else
+    {
+        fprintf(stderr,"Total: %ld\n",(long) chunk[n-1]);
+        fprintf(stderr,"Correct Sum: %ld\n",(long) total_sum);
+    }
+    fprintf(stderr,"Elements: %ld\tTime: %f\n",array_size,end-start);
 }
-free(array);
 free(chunk);
 MPI_Finalize();
 return 0;
@@ -0,0 +1,202 @@
+/* File: scan.c
+   Purpose: Distributed scan library, see scan.h
+   */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "scan.h"
+
+/* MPI user functions get no context pointer, so every operator is created with its
+   own datatype and the datatype is used to look the operator up again */
+#define MAX_SCAN_OPS 64
+static ScanOp * registry[MAX_SCAN_OPS];
+
+/* Segmented pairs hold the value followed by the flag, padded to keep values aligned */
+#define PAIR_SIZE(size) ((size) + 8)
+
+static void scan_user_function(void * in, void * inout, int * len, MPI_Datatype * type)
+{
+    ScanOp * op = NULL;
+    int i;
+    for(i = 0; i < MAX_SCAN_OPS; i++)
+        if(registry[i] && registry[i]->type == *type)
+            op = registry[i];
+    if(op == NULL)
+        return;
+    for(i = 0; i < *len; i++)
+        op->combine((char *) in + i * op->size, (char *) inout + i * op->size);
+}
+
+void scan_op_create(ScanOp * op, size_t size, scan_combine combine, const void * identity)
+{
+    int i;
+    op->size = size;
+    op->combine = combine;
+    op->identity = malloc(size);
+    memcpy(op->identity, identity, size);
+    op->segmented = NULL;
+    MPI_Type_contiguous((int) size, MPI_BYTE, &op->type);
+    MPI_Type_commit(&op->type);
+    MPI_Op_create(scan_user_function, 0, &op->op);
+    for(i = 0; i < MAX_SCAN_OPS && registry[i]; i++);
+    if(i == MAX_SCAN_OPS)
+    {
+        fprintf(stderr,"scan: too many operators\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    registry[i] = op;
+}
+
+void scan_op_free(ScanOp * op)
+{
+    int i;
+    if(op->segmented)
+    {
+        scan_op_free(op->segmented);
+        free(op->segmented);
+    }
+    for(i = 0; i < MAX_SCAN_OPS; i++)
+        if(registry[i] == op)
+            registry[i] = NULL;
+    MPI_Op_free(&op->op);
+    MPI_Type_free(&op->type);
+    free(op->identity);
+}
+
+/* Combine the exclusive prefix of the lower ranks' totals into every element */
+static void apply_offset(char * data, long n, ScanOp * op, const void * total, MPI_Comm comm)
+{
+    void * offset = malloc(op->size);
+    int rank;
+    long i;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Exscan((void *) total, offset, 1, op->type, op->op, comm);
+    /* The result on rank 0 is undefined and there is nothing to add */
+    if(rank != 0)
+        for(i = 0; i < n; i++)
+            op->combine(offset, data + i * op->size);
+    free(offset);
+}
+
+void scan_inclusive(void * data, long n, ScanOp * op, MPI_Comm comm)
+{
+    char * d = (char *) data;
+    void * total = malloc(op->size);
+    long i;
+    memcpy(total, op->identity, op->size);
+    for(i = 1; i < n; i++)
+        op->combine(d + (i - 1) * op->size, d + i * op->size);
+    if(n > 0)
+        memcpy(total, d + (n - 1) * op->size, op->size);
+    apply_offset(d, n, op, total, comm);
+    free(total);
+}
+
+void scan_exclusive(void * data, long n, ScanOp * op, MPI_Comm comm)
+{
+    char * d = (char *) data;
+    void * total = malloc(op->size), * element = malloc(op->size);
+    long i;
+    memcpy(total, op->identity, op->size);
+    for(i = 0; i < n; i++)
+    {
+        memcpy(element, d + i * op->size, op->size);
+        memcpy(d + i * op->size, total, op->size);
+        op->combine(d + i * op->size, element);
+        memcpy(total, element, op->size);
+    }
+    apply_offset(d, n, op, total, comm);
+    free(total);
+    free(element);
+}
+
+static void segmented_user_function(void * in, void * inout, int * len, MPI_Datatype * type)
+{
+    ScanOp * base = NULL;
+    char * left, * right;
+    int i;
+    for(i = 0; i < MAX_SCAN_OPS; i++)
+        if(registry[i] && registry[i]->segmented && registry[i]->segmented->type == *type)
+            base = registry[i];
+    if(base == NULL)
+        return;
+    /* (v1,f1) (+) (v2,f2) = (f2 ? v2 : v1 (+) v2, f1 | f2) */
+    for(i = 0; i < *len; i++)
+    {
+        left = (char *) in + i * PAIR_SIZE(base->size);
+        right = (char *) inout + i * PAIR_SIZE(base->size);
+        if(!right[base->size])
+            base->combine(left, right);
+        right[base->size] |= left[base->size];
+    }
+}
+
+void scan_segmented(void * data, const char * flags, long n, ScanOp * op, MPI_Comm comm)
+{
+    char * d = (char *) data;
+    char * total = (char *) calloc(1, PAIR_SIZE(op->size)), * offset = (char *) malloc(PAIR_SIZE(op->size));
+    long i, first_head = n;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    /* Pair operator used only to combine the chunk totals across ranks */
+    if(op->segmented == NULL)
+    {
+        op->segmented = (ScanOp *) malloc(sizeof(ScanOp));
+        op->segmented->size = PAIR_SIZE(op->size);
+        op->segmented->combine = NULL;
+        op->segmented->identity = calloc(1, PAIR_SIZE(op->size));
+        op->segmented->segmented = NULL;
+        MPI_Type_contiguous((int) PAIR_SIZE(op->size), MPI_BYTE, &op->segmented->type);
+        MPI_Type_commit(&op->segmented->type);
+        MPI_Op_create(segmented_user_function, 0, &op->segmented->op);
+    }
+    /* Local segmented scan, remembering where the first segment of this chunk ends */
+    for(i = 0; i < n; i++)
+    {
+        if(flags[i])
+        {
+            if(first_head == n)
+                first_head = i;
+        }
+        else if(i > 0)
+            op->combine(d + (i - 1) * op->size, d + i * op->size);
+    }
+    /* Chunk total: value of the last segment and whether any segment starts here */
+    memcpy(total, op->identity, op->size);
+    if(n > 0)
+        memcpy(total, d + (n - 1) * op->size, op->size);
+    total[op->size] = (first_head < n);
+    MPI_Exscan(total, offset, 1, op->segmented->type, op->segmented->op, comm);
+    /* Only the elements before the first head continue a segment from a lower rank */
+    if(rank != 0)
+        for(i = 0; i < first_head; i++)
+            op->combine(offset, d + i * op->size);
+    free(total);
+    free(offset);
+}
+
+void combine_sum_i64(const void * left, void * right)
+{
+    *(int64_t *) right += *(const int64_t *) left;
+}
+
+void combine_max_i64(const void * left, void * right)
+{
+    if(*(const int64_t *) left > *(int64_t *) right)
+        *(int64_t *) right = *(const int64_t *) left;
+}
+
+void combine_sum_double(const void * left, void * right)
+{
+    *(double *) right += *(const double *) left;
+}
+
+/* Apply left first, then right: a2*(a1*x + b1) + b2 */
+void combine_affine(const void * left, void * right)
+{
+    const Affine * l = (const Affine *) left;
+    Affine * r = (Affine *) right;
+    r->b = r->a * l->b + r->b;
+    r->a = r->a * l->a;
+}
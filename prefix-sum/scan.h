@@ -0,0 +1,53 @@
+#ifndef SCAN_H
+#define SCAN_H
+/*
+ * File: scan.h
+ * Purpose: Distributed scan library built on the local scan + MPI_Exscan skeleton
+   of prefix_sum.c.  Works for any associative operator on fixed size elements:
+   inclusive, exclusive and segmented (head flag) scans of a block distributed array.
+   The operator does not need to be commutative, lower ranks are always on the left. */
+#include <stddef.h>
+#include <stdint.h>
+#include <mpi.h>
+
+/* right = left (+) right */
+typedef void (*scan_combine)(const void * left, void * right);
+
+/* An associative operator, see scan_op_create() */
+typedef struct ScanOp
+{
+    size_t size;            /* bytes per element */
+    scan_combine combine;
+    void * identity;        /* copy of the identity element */
+    MPI_Datatype type;      /* private type, identifies the operator inside MPI */
+    MPI_Op op;
+    /* Operator on (value, head flag) pairs, created on first segmented scan */
+    struct ScanOp * segmented;
+} ScanOp;
+
+/* Create an operator on elements of the given size */
+void scan_op_create(ScanOp * op, size_t size, scan_combine combine, const void * identity);
+void scan_op_free(ScanOp * op);
+
+/* data[i] = data[0] (+) ... (+) data[i] over the whole distributed array */
+void scan_inclusive(void * data, long n, ScanOp * op, MPI_Comm comm);
+
+/* data[i] = data[0] (+) ... (+) data[i-1], the first element gets the identity */
+void scan_exclusive(void * data, long n, ScanOp * op, MPI_Comm comm);
+
+/* Inclusive scan that restarts at every element whose flag is set */
+void scan_segmented(void * data, const char * flags, long n, ScanOp * op, MPI_Comm comm);
+
+/* Ready made operators */
+void combine_sum_i64(const void * left, void * right);
+void combine_max_i64(const void * left, void * right);
+void combine_sum_double(const void * left, void * right);
+
+/* Affine map x -> a*x + b, the scan composes maps left to right */
+typedef struct
+{
+    double a, b;
+} Affine;
+void combine_affine(const void * left, void * right);
+
+#endif